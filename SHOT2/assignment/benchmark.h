@@ -0,0 +1,919 @@
+// HOW IT WORKS:
+//
+// Benchmarks for the particle update.
+// Set the SHOT2_BENCHMARK environment variable (to anything) and the benchmarks run once at startup,
+// before the game loop, with the results printed to the output window.
+//
+// benchmark_process compares the type batched process loop against
+// the original particle::process virtual dispatch path, which is kept here (in namespace legacy) for reference only.
+// Both paths are given the same number of particles, spawned round-robin between the 3 built in types as the original emit did,
+// and are stepped with the same fixed elapsed time.
+// Note the legacy path also lerps & stores colour every update, the batched path derives colour when rendering.
+//
+// benchmark_integrate times each integration kernel the cpu supports (see particle_simd.h)
+// and checks that every kernel's output is bit identical to the scalar kernel's.
+//
+// check_vertex_cull draws a cluster of particles in each quarter of the screen (& some off it) as a point list,
+// with & without each SHOT2_CULL mode, & checks the pictures match pixel for pixel (see vertex_cull.h).
+// The reference picture maps world positions to pixels on its own (point_pixel in software_renderer.h),
+// & points at known positions must light known pixels, so a wrong origin or y direction cannot pass by agreeing with itself.
+// check_software_renderer draws the same points with the software renderer's tiled steps & checks them the same way,
+// & that the sprite a window draws the framebuffer with puts each pixel back where the points would be.
+//
+// benchmark_random compares std::random_device (the original random_getd) against the per thread
+// xoshiro128+ engine behind random_getd & the batched random_fill (see fast_random.h).
+//
+// The measure_* functions are microbenchmarks run through benchmark_suite (see microbenchmark.h),
+// each with warm-up & repeated measurements, reporting percentiles & hardware counters:
+//   process      - process on every type at various live particle counts
+//   update_chunk - the fused pass (integrate, expire & write vertices) at the same counts, compare with process + draw
+//   update_chunk_analytic - analytic mode's pass (evaluate, expire & write vertices) at the same counts
+//   emit         - emit & spawning into an empty slice at various spawn rates
+//   draw         - filling particle_renderer_2d's vertex array, one vertex per particle as update_chunk writes them
+//   random       - the random helpers, per number generated
+//   update       - particle_system_t::update end to end at 1, 2, 4, 8 & all hardware threads, for a scaling curve
+//                  & in analytic mode at all hardware threads
+// The results are written as JSON to SHOT2_BENCHMARK_JSON (default 'Benchmark Results.json'),
+// labelled with SHOT2_BENCHMARK_LABEL (e.g. a commit hash) so runs from different commits can be compared.
+
+
+
+#pragma once
+
+#include "constants.h"
+#include "microbenchmark.h"
+#include "particle_system.h"
+#include "timer.h"
+
+#include "magpie.h"
+
+#include <cstdlib>  // for std::getenv
+#include <cstring>  // for std::memcmp
+#include <random>   // for std::random_device, std::uniform_real_distribution
+#include <vector>
+
+
+namespace legacy
+{
+  // the original heap allocated, virtually dispatched particles, unchanged apart from being condensed
+
+  class particle
+  {
+  public:
+    virtual ~particle () = default;
+    virtual bool process (float elapsed_seconds) = 0;
+
+    float  life_time = {};
+    float  life_remaining = {};
+    float  kill_y = {};
+
+    vector4 position = {};
+    vector4 velocity = {};
+    vector4 acceleration = {};
+
+    colourf colour = {};
+    colourf start_colour = {};
+    colourf end_colour = {};
+
+  protected:
+    void integrate (float elapsed_seconds)
+    {
+      position.x += velocity.x * elapsed_seconds;
+      position.y += velocity.y * elapsed_seconds;
+
+      velocity.x += acceleration.x * elapsed_seconds;
+      velocity.y += acceleration.y * elapsed_seconds;
+
+      colour.r = lerp (end_colour.r, start_colour.r, life_remaining / life_time);
+      colour.g = lerp (end_colour.g, start_colour.g, life_remaining / life_time);
+      colour.b = lerp (end_colour.b, start_colour.b, life_remaining / life_time);
+      colour.a = lerp (end_colour.a, start_colour.a, life_remaining / life_time);
+
+      life_remaining -= elapsed_seconds;
+    }
+  };
+
+  class particle_a : public particle
+  {
+  public:
+    particle_a ()
+    {
+      life_time = life_remaining = random_getd (7.5f, 13.0f);
+      kill_y = -(float)SCREEN_HEIGHT / 2.0f;
+
+      position = { -(float)SCREEN_WIDTH / 2.0f + random_getd (0.0f, 200.0f),
+        -(float)SCREEN_HEIGHT / 2.0f + random_getd (0.0f, 100.0f) };
+      velocity = { random_getd (magpie::maths::cos (magpie::maths::radians (89.0f)), magpie::maths::cos (magpie::maths::radians (75.0f))) * 200.f,
+        random_getd (magpie::maths::sin (magpie::maths::radians (75.0f)), magpie::maths::sin (magpie::maths::radians (89.0f))) * 200.f };
+      acceleration = { 2.0f, -26.5f };
+
+      start_colour = { 1.0f, 0.2f, 0.2f, 1.0f };
+      end_colour = { 0.2f, 1.0f, 1.0f, 1.0f };
+    }
+
+    bool process (float elapsed_seconds) override
+    {
+      integrate (elapsed_seconds);
+      return life_remaining <= 0.0f || position.y < kill_y;
+    }
+  };
+
+  class particle_b : public particle
+  {
+  public:
+    particle_b ()
+    {
+      life_time = life_remaining = random_getd (9.0f, 10.0f);
+      kill_y = -(float)SCREEN_HEIGHT / 2.0f + 50.0f;
+
+      position = { random_getd (0.0f, (float)SCREEN_WIDTH / 3.0f), (float)SCREEN_HEIGHT / 2.0f };
+      velocity = { -50.0f, random_getd (-100.0f, -60.0f) };
+      acceleration = { 0.0f, 0.0f };
+
+      start_colour = { 0.2f, 1.0f, 0.2f, 1.0f };
+      end_colour = { 1.0f, 0.2f, 1.0f, 1.0f };
+    }
+
+    bool process (float elapsed_seconds) override
+    {
+      integrate (elapsed_seconds);
+      return position.y < kill_y || life_remaining <= 0.0f;
+    }
+  };
+
+  class particle_c : public particle
+  {
+  public:
+    particle_c ()
+    {
+      life_time = life_remaining = random_getd (3.5f, 6.0f);
+      kill_y = -(float)SCREEN_HEIGHT / 2.0f + 15.0f;
+
+      position = { (float)SCREEN_WIDTH / 2.0f - 300.0f, -(float)SCREEN_HEIGHT / 2.0f + 400.0f };
+      velocity = { random_getd (-50.0f, 50.0f), random_getd (-50.0f, 50.0f) };
+      acceleration = { 0.0f, 0.0f };
+
+      start_colour = { 0.2f, 0.2f, 1.0f, 1.0f };
+      end_colour = { 1.0f, 1.0f, 0.2f, 1.0f };
+    }
+
+    bool process (float elapsed_seconds) override
+    {
+      integrate (elapsed_seconds);
+      return life_remaining <= 0.0f || position.y < kill_y;
+    }
+  };
+
+  /// <summary>
+  /// the original process loop, update every particle through its vtable, delete & swap-pop expired particles
+  /// </summary>
+  static void process (std::vector <particle*>& particles, float elapsed_seconds)
+  {
+    std::vector <particle*>::iterator it = particles.begin ();
+    while (it != particles.end ())
+    {
+      particle* p = *it;
+      if (p->process (elapsed_seconds))
+      {
+        delete p;
+        std::swap (*it, particles.back ());
+        particles.pop_back ();
+      }
+      else
+      {
+        it++;
+      }
+    }
+  }
+}
+
+
+/// <summary>
+/// the built in particle types, which every benchmark uses (whatever SHOT2_EMITTERS is set to) so results stay comparable
+/// </summary>
+static std::vector <particle_type_desc> const& benchmark_types ()
+{
+  static std::vector <particle_type_desc> const types = default_particle_types ();
+  return types;
+}
+
+/// <summary>
+/// an arena with every chunk backed by memory, as the benchmarks use its chunks directly rather than through take_chunk
+/// </summary>
+static bool initialise_benchmark_arena (particle_arena& arena, unsigned chunk_capacity, unsigned num_chunks)
+{
+  if (!arena.initialise (chunk_capacity, num_chunks) || !arena.commit_all ())
+  {
+    magpie::printf ("benchmark: not enough memory for %u chunks of %u particles\n", num_chunks, chunk_capacity);
+    return false;
+  }
+  return true;
+}
+
+/// <summary>
+/// time num_frames updates of num_particles particles on both the legacy virtual path & the type batched path
+/// </summary>
+/// <param name="num_particles">number of particles spawned before the first update</param>
+/// <param name="num_frames">number of updates to time</param>
+/// <param name="elapsed_seconds">fixed elapsed time used for every update</param>
+static void benchmark_process (unsigned num_particles, unsigned num_frames, float elapsed_seconds)
+{
+  // legacy - one heap allocation per particle, types interleaved
+  std::vector <legacy::particle*> legacy_particles;
+  legacy_particles.reserve (num_particles);
+  for (unsigned i = 0u; i < num_particles; ++i)
+  {
+    switch (i % NUM_PARTICLE_TYPES)
+    {
+    case 0:  legacy_particles.push_back (new legacy::particle_a); break;
+    case 1:  legacy_particles.push_back (new legacy::particle_b); break;
+    default: legacy_particles.push_back (new legacy::particle_c); break;
+    }
+  }
+
+  // type batched - one pool per type
+  particle_arena arena;
+  if (!initialise_benchmark_arena (arena, num_particles / NUM_PARTICLE_TYPES + 1u, NUM_PARTICLE_TYPES))
+  {
+    return;
+  }
+  particle_pool pools [NUM_PARTICLE_TYPES];
+  for (unsigned type = 0u; type < NUM_PARTICLE_TYPES; ++type)
+  {
+    pools [type] = arena.chunk (type);
+  }
+  std::vector <particle_type_desc> const& types = benchmark_types ();
+  for (unsigned i = 0u; i < num_particles; ++i)
+  {
+    particle_pool& pool = pools [i % NUM_PARTICLE_TYPES];
+    initialise_particle (pool, pool.spawn (), thread_random_engine (), types [i % NUM_PARTICLE_TYPES].spawn);
+  }
+
+  // count every particle update performed, particles expire at the same rate on both paths but not at exactly the same time
+  Timer timer;
+  long long legacy_updates = 0, batched_updates = 0;
+
+  timer.start ();
+  for (unsigned frame = 0u; frame < num_frames; ++frame)
+  {
+    legacy_updates += (long long)legacy_particles.size ();
+    legacy::process (legacy_particles, elapsed_seconds);
+  }
+  timer.stop ();
+  float const legacy_ms = timer.get_elapsed_ms ();
+
+  timer.start ();
+  for (unsigned frame = 0u; frame < num_frames; ++frame)
+  {
+    for (unsigned type = 0u; type < NUM_PARTICLE_TYPES; ++type)
+    {
+      batched_updates += (long long)pools [type].count;
+      process (pools [type], types [type], elapsed_seconds);
+    }
+  }
+  timer.stop ();
+  float const batched_ms = timer.get_elapsed_ms ();
+
+  float const legacy_ns = legacy_updates > 0 ? legacy_ms * 1'000'000.f / (float)legacy_updates : 0.0f;
+  float const batched_ns = batched_updates > 0 ? batched_ms * 1'000'000.f / (float)batched_updates : 0.0f;
+
+  magpie::printf ("process: %u particles, %u frames\n", num_particles, num_frames);
+  magpie::printf ("  virtual:      %8.2f ms, %6.3f ns/P\n", legacy_ms, legacy_ns);
+  magpie::printf ("  type batched: %8.2f ms, %6.3f ns/P (%.2fx)\n", batched_ms, batched_ns,
+    batched_ns > 0.0f ? legacy_ns / batched_ns : 0.0f);
+
+  for (legacy::particle* p : legacy_particles)
+  {
+    delete p;
+  }
+}
+
+/// <summary>
+/// time every supported integration kernel over the same particles & check they match the scalar kernel bit for bit
+/// </summary>
+/// <param name="num_particles">number of particles to integrate</param>
+/// <param name="num_frames">number of updates to time</param>
+/// <param name="elapsed_seconds">fixed elapsed time used for every update</param>
+/// <returns>true, if every kernel matched the scalar kernel</returns>
+static bool benchmark_integrate (unsigned num_particles, unsigned num_frames, float elapsed_seconds)
+{
+  // source, working copy & the scalar kernel's reference result
+  particle_arena arena;
+  if (!initialise_benchmark_arena (arena, num_particles, 3u))
+  {
+    return false;
+  }
+  particle_pool source = arena.chunk (0u), particles = arena.chunk (1u), reference = arena.chunk (2u);
+  particle_type_desc const& type = benchmark_types () [0];
+  for (unsigned i = 0u; i < num_particles; ++i)
+  {
+    initialise_particle (source, source.spawn (), thread_random_engine (), type.spawn);
+  }
+
+  float const delta_velocity_x = type.acceleration.x * elapsed_seconds;
+  float const delta_velocity_y = type.acceleration.y * elapsed_seconds;
+
+  std::vector <particle_integrate_kernel> kernels = { integrate_scalar };
+#if PARTICLE_SIMD_X86
+  cpu_features const features = detect_cpu_features ();
+  if (features.sse2) kernels.push_back (integrate_sse2);
+  if (features.avx2) kernels.push_back (integrate_avx2);
+  if (features.avx512f) kernels.push_back (integrate_avx512);
+#endif // PARTICLE_SIMD_X86
+
+  magpie::printf ("integrate: %u particles, %u frames\n", num_particles, num_frames);
+
+  bool all_match = true;
+  float scalar_ns = 0.0f;
+  for (particle_integrate_kernel kernel : kernels)
+  {
+    // every kernel starts from the same particles, the count is odd so the scalar remainder is exercised too
+    particles.copy_from (source);
+    unsigned const count = particles.count > 0u ? (particles.count - 1u) | 1u : 0u;
+
+    Timer timer;
+    timer.start ();
+    for (unsigned frame = 0u; frame < num_frames; ++frame)
+    {
+      kernel (particles.position_x, particles.position_y,
+        particles.velocity_x, particles.velocity_y, particles.life_remaining, count,
+        elapsed_seconds, delta_velocity_x, delta_velocity_y);
+    }
+    timer.stop ();
+
+    float const ns = count > 0u ? timer.get_elapsed_ms () * 1'000'000.f / ((float)count * (float)num_frames) : 0.0f;
+    if (kernel == integrate_scalar)
+    {
+      reference.copy_from (particles);
+      scalar_ns = ns;
+    }
+
+    bool const match =
+      std::memcmp (particles.position_x, reference.position_x, count * sizeof (float)) == 0 &&
+      std::memcmp (particles.position_y, reference.position_y, count * sizeof (float)) == 0 &&
+      std::memcmp (particles.velocity_x, reference.velocity_x, count * sizeof (float)) == 0 &&
+      std::memcmp (particles.velocity_y, reference.velocity_y, count * sizeof (float)) == 0 &&
+      std::memcmp (particles.life_remaining, reference.life_remaining, count * sizeof (float)) == 0;
+    all_match = all_match && match;
+
+    magpie::printf ("  %-8s %6.3f ns/P (%.2fx) %s\n", particle_integrate_kernel_name (kernel), ns,
+      ns > 0.0f ? scalar_ns / ns : 0.0f, match ? "matches scalar" : "DOES NOT MATCH SCALAR");
+  }
+
+  MAGPIE_DASSERT (all_match);
+  return all_match;
+}
+
+/// <summary>
+/// time generating count uniform floats with std::random_device, random_getd & random_fill
+/// </summary>
+/// <param name="count">number of random numbers to generate</param>
+static void benchmark_random (unsigned count)
+{
+  std::vector <float> values (count);
+  Timer timer;
+
+  // the original random_getd
+  std::random_device rd;
+  std::uniform_real_distribution <float> distribution (0.0f, 1.0f);
+  timer.start ();
+  for (unsigned i = 0u; i < count; ++i)
+  {
+    values [i] = distribution (rd);
+  }
+  timer.stop ();
+  float const device_ns = timer.get_elapsed_ms () * 1'000'000.f / (float)count;
+
+  timer.start ();
+  for (unsigned i = 0u; i < count; ++i)
+  {
+    values [i] = random_getd (0.0f, 1.0f);
+  }
+  timer.stop ();
+  float const engine_ns = timer.get_elapsed_ms () * 1'000'000.f / (float)count;
+
+  timer.start ();
+  random_fill (values.data (), count, 0.0f, 1.0f);
+  timer.stop ();
+  float const batch_ns = timer.get_elapsed_ms () * 1'000'000.f / (float)count;
+
+  magpie::printf ("random: %u floats\n", count);
+  magpie::printf ("  std::random_device %7.3f ns/number\n", device_ns);
+  magpie::printf ("  random_getd        %7.3f ns/number (%.1fx)\n", engine_ns, engine_ns > 0.0f ? device_ns / engine_ns : 0.0f);
+  magpie::printf ("  random_fill        %7.3f ns/number (%.1fx)\n", batch_ns, batch_ns > 0.0f ? device_ns / batch_ns : 0.0f);
+}
+
+/// <summary>
+/// draw opaque vertices in order, as a point list is drawn, with point_pixel rather than vertex_cull.h
+/// </summary>
+/// <returns>the picture, row by row from the top left, transparent where nothing was drawn</returns>
+static std::vector <sf::Color> reference_draw_points (sf::Vertex const* vertices, size_t count)
+{
+  std::vector <sf::Color> picture ((size_t)SCREEN_WIDTH * SCREEN_HEIGHT, sf::Color::Transparent);
+  splat_points (vertices, count, picture.data ());
+  return picture;
+}
+
+/// <summary>
+/// a world position & the pixel it must light, the corners & the pixels either side of the origin
+/// </summary>
+struct known_pixel
+{
+  float x, y;
+  unsigned column, row;
+};
+
+static known_pixel const KNOWN_PIXELS [] = {
+  { -860.0f, 440.0f, 0u, 0u },          // top left
+  { 859.5f, -439.5f, 1719u, 879u },     // bottom right
+  { -0.5f, 0.5f, 859u, 439u },          // up & left of the origin
+  { 0.5f, -0.5f, 860u, 440u },          // down & right of the origin
+  { -430.25f, 220.75f, 429u, 219u },    // middle of the top left quarter
+  { 430.25f, -220.75f, 1290u, 660u } }; // middle of the bottom right quarter
+
+/// <returns>number of pixels that differ between two pictures</returns>
+static unsigned count_different_pixels (std::vector <sf::Color> const& a, std::vector <sf::Color> const& b)
+{
+  unsigned num_different = 0u;
+  for (size_t i = 0u; i < a.size (); ++i)
+  {
+    num_different += a [i].r != b [i].r || a [i].g != b [i].g || a [i].b != b [i].b || a [i].a != b [i].a ? 1u : 0u;
+  }
+  return num_different;
+}
+
+/// <summary>
+/// vertices to check drawing with: an overlapping cluster in each quarter of the screen, so most pixels are drawn several times,
+/// vertices just off each edge & empty vertex slots
+/// </summary>
+static std::vector <sf::Vertex> point_check_vertices ()
+{
+  std::vector <sf::Vertex> vertices;
+  random_engine random (1u);
+  float const quarter_x = (float)SCREEN_WIDTH * 0.25f, quarter_y = (float)SCREEN_HEIGHT * 0.25f;
+  for (unsigned quadrant = 0u; quadrant < 4u; ++quadrant)
+  {
+    float const centre_x = quadrant & 1u ? quarter_x : -quarter_x, centre_y = quadrant & 2u ? quarter_y : -quarter_y;
+    for (unsigned i = 0u; i < 10000u; ++i)
+    {
+      // 40 x 40 pixels, each drawn ~6 times, in a different colour each time
+      vertices.push_back (sf::Vertex (sf::Vector2f (random.uniform (centre_x - 20.0f, centre_x + 20.0f), random.uniform (centre_y - 20.0f, centre_y + 20.0f)),
+        sf::Color ((sf::Uint8)(i * 7u), (sf::Uint8)(i * 13u), (sf::Uint8)(quadrant * 64u), 255u)));
+    }
+  }
+
+  float const half_width = (float)SCREEN_WIDTH * 0.5f, half_height = (float)SCREEN_HEIGHT * 0.5f;
+  sf::Vector2f const off_screen [] = {
+    { -half_width - 0.5f, 0.0f }, { half_width, 0.0f }, { 0.0f, half_height + 0.5f }, { 0.0f, -half_height - 0.5f } };
+  for (sf::Vector2f const position : off_screen)
+  {
+    vertices.push_back (sf::Vertex (position, sf::Color::Black));
+  }
+  vertices.push_back (EMPTY_VERTEX);
+  return vertices;
+}
+
+/// <summary>
+/// check culling leaves the point list's picture as it was, see the top of this file
+/// </summary>
+/// <returns>true, if every check passed</returns>
+static bool check_vertex_cull ()
+{
+  magpie::printf ("vertex culling check:\n");
+  bool passed = true;
+
+  for (known_pixel const& point : KNOWN_PIXELS)
+  {
+    sf::Vertex const vertex (sf::Vector2f (point.x, point.y), sf::Color::White);
+    unsigned column = 0u, row = 0u;
+    bool const reference_ok = point_pixel (point.x, point.y, column, row) && column == point.column && row == point.row;
+    bool const cull_ok = vertex_on_screen (vertex) && vertex_pixel (vertex) == point.row * SCREEN_WIDTH + point.column;
+    if (!reference_ok || !cull_ok)
+    {
+      magpie::printf ("  (%.2f, %.2f) should light column %u row %u, %s\n", point.x, point.y, point.column, point.row,
+        reference_ok ? "vertex_pixel does not" : "the reference does not");
+      passed = false;
+    }
+  }
+
+  std::vector <sf::Vertex> const vertices = point_check_vertices ();
+  std::vector <sf::Color> const picture = reference_draw_points (vertices.data (), vertices.size ());
+  unsigned num_on_screen = 0u;
+  for (sf::Vertex const& vertex : vertices)
+  {
+    unsigned column, row;
+    num_on_screen += point_pixel (vertex.position.x, vertex.position.y, column, row) ? 1u : 0u;
+  }
+
+  for (vertex_cull_mode const mode : { vertex_cull_mode::screen, vertex_cull_mode::pixel })
+  {
+    vertex_culler culler;
+    culler.initialise (mode);
+    culler.next_frame ();
+    unsigned const count = (unsigned)vertices.size ();
+    if (mode == vertex_cull_mode::pixel)
+    {
+      culler.claim (vertices.data (), 0u, count);
+    }
+    std::vector <sf::Vertex> kept (culler.count (vertices.data (), 0u, count));
+    culler.compact (vertices.data (), 0u, count, kept.data ());
+
+    unsigned const num_different = count_different_pixels (picture, reference_draw_points (kept.data (), kept.size ()));
+    bool const kept_ok = mode == vertex_cull_mode::pixel || kept.size () == num_on_screen;
+    magpie::printf ("  cull %-6s %6u of %u vertices kept (%u on screen), %u pixels differ from the point list\n",
+      vertex_cull_mode_name (mode), (unsigned)kept.size (), count, num_on_screen, num_different);
+    passed = passed && num_different == 0u && kept_ok;
+  }
+
+  magpie::printf ("  %s\n", passed ? "passed" : "FAILED");
+  return passed;
+}
+
+/// <summary>
+/// check the software renderer's tiles draw the same picture as the points drawn in order, see the top of this file
+/// </summary>
+/// <returns>true, if every check passed</returns>
+static bool check_software_renderer ()
+{
+  magpie::printf ("software renderer check:\n");
+  bool passed = true;
+
+  // the known pixels go last, so they are on top of the clusters
+  std::vector <sf::Vertex> vertices = point_check_vertices ();
+  for (known_pixel const& point : KNOWN_PIXELS)
+  {
+    vertices.push_back (sf::Vertex (sf::Vector2f (point.x, point.y), sf::Color::White));
+  }
+  unsigned const count = (unsigned)vertices.size ();
+
+  // the steps one after the other on this thread, as 2 threads would share them
+  software_renderer_2d renderer;
+  renderer.initialise (2u, count, sf::Color::Black);
+  unsigned const half = count / 2u;
+  renderer.count (0u, vertices.data (), 0u, half);
+  renderer.count (1u, vertices.data (), half, count);
+  unsigned const num_splats = renderer.place ();
+  renderer.bin (0u, vertices.data (), 0u, half);
+  renderer.bin (1u, vertices.data (), half, count);
+  renderer.draw_tiles ();
+  sf::Color const* const framebuffer = renderer.get_framebuffer ();
+
+  for (known_pixel const& point : KNOWN_PIXELS)
+  {
+    sf::Color const colour = framebuffer [point.row * SCREEN_WIDTH + point.column];
+    if (colour.r != 255u || colour.g != 255u || colour.b != 255u)
+    {
+      magpie::printf ("  (%.2f, %.2f) should light column %u row %u, the tiles do not\n", point.x, point.y, point.column, point.row);
+      passed = false;
+    }
+  }
+
+  // in a window the sprite must put each pixel's texel where the points would be drawn
+  sf::Transform const& sprite_transform = renderer.get_sprite_transform ();
+  for (known_pixel const& point : KNOWN_PIXELS)
+  {
+    sf::Vector2f const centre = sprite_transform.transformPoint ((float)point.column + 0.5f, (float)point.row + 0.5f);
+    unsigned column = 0u, row = 0u;
+    if (!point_pixel (centre.x, centre.y, column, row) || column != point.column || row != point.row)
+    {
+      magpie::printf ("  the sprite draws column %u row %u at (%.2f, %.2f), not over (%.2f, %.2f)\n", point.column, point.row,
+        centre.x, centre.y, point.x, point.y);
+      passed = false;
+    }
+  }
+
+  std::vector <sf::Color> picture ((size_t)SCREEN_WIDTH * SCREEN_HEIGHT, sf::Color::Black);
+  splat_points (vertices.data (), vertices.size (), picture.data ());
+  unsigned const num_different =
+    count_different_pixels (picture, std::vector <sf::Color> (framebuffer, framebuffer + (size_t)SCREEN_WIDTH * SCREEN_HEIGHT));
+  magpie::printf ("  %u of %u vertices on screen, %u pixels differ from the point list\n", num_splats, count, num_different);
+  passed = passed && num_different == 0u;
+  renderer.release ();
+
+  magpie::printf ("  %s\n", passed ? "passed" : "FAILED");
+  return passed;
+}
+
+/// <summary>
+/// point each type's pool at its own arena chunk, each chunk is big enough for num_particles / NUM_PARTICLE_TYPES
+/// </summary>
+static void attach_benchmark_pools (particle_arena const& arena, unsigned first_chunk, particle_pool (&pools) [NUM_PARTICLE_TYPES])
+{
+  for (unsigned type = 0u; type < NUM_PARTICLE_TYPES; ++type)
+  {
+    pools [type] = arena.chunk (first_chunk + type);
+  }
+}
+
+/// <summary>
+/// spawn num_particles particles round-robin between the types, as emit does
+/// </summary>
+static void spawn_benchmark_particles (particle_pool (&pools) [NUM_PARTICLE_TYPES], unsigned num_particles, random_engine& random)
+{
+  std::vector <particle_type_desc> const& types = benchmark_types ();
+  for (unsigned i = 0u; i < num_particles; ++i)
+  {
+    particle_pool& pool = pools [i % NUM_PARTICLE_TYPES];
+    initialise_particle (pool, pool.spawn (), random, types [i % NUM_PARTICLE_TYPES].spawn);
+  }
+}
+
+/// <summary>
+/// process on every type, each repetition starting from the same particles
+/// </summary>
+static void measure_process (benchmark_suite& suite, unsigned num_particles, float elapsed_seconds)
+{
+  particle_arena arena;
+  if (!initialise_benchmark_arena (arena, num_particles / NUM_PARTICLE_TYPES + 1u, NUM_PARTICLE_TYPES * 2u))
+  {
+    return;
+  }
+  particle_pool source [NUM_PARTICLE_TYPES], pools [NUM_PARTICLE_TYPES];
+  attach_benchmark_pools (arena, 0u, source);
+  attach_benchmark_pools (arena, NUM_PARTICLE_TYPES, pools);
+
+  random_engine random (1u);
+  spawn_benchmark_particles (source, num_particles, random);
+
+  suite.run ("process", { { "particles", (double)num_particles } },
+    [&]
+    {
+      for (unsigned type = 0u; type < NUM_PARTICLE_TYPES; ++type)
+        pools [type].copy_from (source [type]);
+    },
+    [&]
+    {
+      for (unsigned type = 0u; type < NUM_PARTICLE_TYPES; ++type)
+        process (pools [type], benchmark_types () [type], elapsed_seconds);
+      return num_particles;
+    });
+}
+
+/// <summary>
+/// update_chunk on every type, writing vertices & with nothing to spawn, each repetition starting from the same particles
+/// compare against process + draw for the cost of the separate passes
+/// </summary>
+static void measure_update_chunk (benchmark_suite& suite, unsigned num_particles, float elapsed_seconds)
+{
+  particle_arena arena;
+  if (!initialise_benchmark_arena (arena, num_particles / NUM_PARTICLE_TYPES + 1u, NUM_PARTICLE_TYPES * 2u))
+  {
+    return;
+  }
+  particle_pool source [NUM_PARTICLE_TYPES], pools [NUM_PARTICLE_TYPES];
+  attach_benchmark_pools (arena, 0u, source);
+  attach_benchmark_pools (arena, NUM_PARTICLE_TYPES, pools);
+
+  random_engine random (1u);
+  spawn_benchmark_particles (source, num_particles, random);
+
+  // each type writes to its own part of the vertex array
+  unsigned const type_vertices = pools [0].capacity;
+  std::vector <sf::Vertex> vertices (type_vertices * NUM_PARTICLE_TYPES);
+
+  suite.run ("update_chunk", { { "particles", (double)num_particles } },
+    [&]
+    {
+      for (unsigned type = 0u; type < NUM_PARTICLE_TYPES; ++type)
+        pools [type].copy_from (source [type]);
+    },
+    [&]
+    {
+      for (unsigned type = 0u; type < NUM_PARTICLE_TYPES; ++type)
+        update_chunk (pools [type], benchmark_types () [type], elapsed_seconds, 0.0f, vertices.data () + type_vertices * type);
+      return num_particles;
+    });
+}
+
+/// <summary>
+/// update_chunk_analytic on every type, writing vertices & with nothing to spawn or expire, one frame after the particles spawned
+/// compare against update_chunk for the cost of integrating & writing back every frame
+/// </summary>
+static void measure_update_chunk_analytic (benchmark_suite& suite, unsigned num_particles, float elapsed_seconds)
+{
+  particle_arena arena;
+  if (!initialise_benchmark_arena (arena, num_particles / NUM_PARTICLE_TYPES + 1u, NUM_PARTICLE_TYPES * 2u))
+  {
+    return;
+  }
+  particle_pool source [NUM_PARTICLE_TYPES], pools [NUM_PARTICLE_TYPES];
+  attach_benchmark_pools (arena, 0u, source);
+  attach_benchmark_pools (arena, NUM_PARTICLE_TYPES, pools);
+
+  // spawned by update_chunk_analytic, so each type's particles are in death order
+  for (unsigned type = 0u; type < NUM_PARTICLE_TYPES; ++type)
+  {
+    source [type].spawn_quota = num_particles / NUM_PARTICLE_TYPES + (type < num_particles % NUM_PARTICLE_TYPES ? 1u : 0u);
+    source [type].random.seed (1u + type);
+    update_chunk_analytic (source [type], benchmark_types () [type], 0.0f, 0.0f, nullptr);
+  }
+
+  unsigned const type_vertices = pools [0].capacity;
+  std::vector <sf::Vertex> vertices (type_vertices * NUM_PARTICLE_TYPES);
+
+  suite.run ("update_chunk_analytic", { { "particles", (double)num_particles } },
+    [&]
+    {
+      for (unsigned type = 0u; type < NUM_PARTICLE_TYPES; ++type)
+        pools [type].copy_from (source [type]);
+    },
+    [&]
+    {
+      for (unsigned type = 0u; type < NUM_PARTICLE_TYPES; ++type)
+        update_chunk_analytic (pools [type], benchmark_types () [type], elapsed_seconds, elapsed_seconds,
+          vertices.data () + type_vertices * type);
+      return num_particles;
+    });
+}
+
+/// <summary>
+/// emit into an empty slice, chunks are kept between repetitions so allocation is not measured
+/// </summary>
+static void measure_emit (benchmark_suite& suite, unsigned spawn_rate, float elapsed_seconds)
+{
+  particle_slice slice;
+  slice.max_particles = PARTICLE_MAX;
+  slice.spawn_rate = spawn_rate;
+  slice.random.seed (1u);
+
+  // the slice is emptied before every repetition, so it never holds more than one emit's worth of particles
+  particle_arena arena;
+  std::vector <particle_type_desc> const& types = benchmark_types ();
+  unsigned const num_chunks = particle_slice::chunks_needed (spawn_rate, (unsigned)types.size ());
+  arena.initialise (PARTICLE_CHUNK_SIZE, num_chunks);
+  slice.initialise (arena, 0u, 0u, num_chunks, (unsigned)types.size ());
+
+  suite.run ("emit", { { "spawn_rate", (double)spawn_rate } },
+    [&]
+    {
+      for (std::vector <particle_pool>& type_chunks : slice.chunks)
+        for (particle_pool& chunk : type_chunks)
+          chunk.count = 0u;
+    },
+    [&]
+    {
+      emit (slice, types, elapsed_seconds);
+      for (unsigned type = 0u; type < (unsigned)types.size (); ++type)
+        for (particle_pool& chunk : slice.chunks [type])
+          update_chunk (chunk, types [type], elapsed_seconds, 0.0f, nullptr);
+      return spawn_rate;
+    });
+
+  slice.release ();
+}
+
+/// <summary>
+/// filling particle_renderer_2d's vertex array, one vertex per particle
+/// </summary>
+static void measure_draw (benchmark_suite& suite, unsigned num_particles)
+{
+  particle_arena arena;
+  if (!initialise_benchmark_arena (arena, num_particles / NUM_PARTICLE_TYPES + 1u, NUM_PARTICLE_TYPES))
+  {
+    return;
+  }
+  particle_pool pools [NUM_PARTICLE_TYPES];
+  attach_benchmark_pools (arena, 0u, pools);
+
+  random_engine random (1u);
+  spawn_benchmark_particles (pools, num_particles, random);
+
+  particle_renderer_2d renderer;
+  renderer.initialise (num_particles);
+
+  // the same vertex write as update_chunk, the colour is a look up in the type's colour table (see particle_colour_index)
+  auto const fill = [] (particle_type_desc const& type, particle_pool const& pool, sf::Vertex* vertices)
+  {
+    for (unsigned i = 0u; i < pool.count; ++i)
+    {
+      vertices [i] = sf::Vertex (sf::Vector2f (pool.position_x [i], pool.position_y [i]),
+        type.colours [particle_colour_index (pool.life_remaining [i], pool.inv_life_time [i])]);
+    }
+  };
+
+  suite.run ("draw", { { "particles", (double)num_particles } },
+    [&] { renderer.discard (); },
+    [&]
+    {
+      sf::Vertex* vertices = renderer.reserve (num_particles);
+      for (unsigned type = 0u; type < NUM_PARTICLE_TYPES; ++type)
+      {
+        fill (benchmark_types () [type], pools [type], vertices);
+        vertices += pools [type].count;
+      }
+      return renderer.get_num_vertices ();
+    });
+
+  renderer.release ();
+}
+
+/// <summary>
+/// the random helpers, per number generated
+/// </summary>
+static void measure_random (benchmark_suite& suite, unsigned count)
+{
+  std::vector <float> values (count);
+  std::vector <long long> integers (count);
+
+  suite.run ("random_getd", { { "count", (double)count } }, [&]
+    {
+      for (unsigned i = 0u; i < count; ++i)
+        values [i] = random_getd (0.0f, 1.0f);
+      return count;
+    });
+  suite.run ("random_geti", { { "count", (double)count } }, [&]
+    {
+      for (unsigned i = 0u; i < count; ++i)
+        integers [i] = random_geti (0, 100);
+      return count;
+    });
+  suite.run ("random_fill", { { "count", (double)count } }, [&]
+    {
+      random_fill (values.data (), count, 0.0f, 1.0f);
+      return count;
+    });
+}
+
+/// <summary>
+/// particle_system_t::update end to end, one frame per repetition, time per live particle
+/// </summary>
+static void measure_update (benchmark_suite& suite, unsigned num_threads, float elapsed_seconds, bool analytic = false)
+{
+  // deterministic, so every thread count sees the same particles
+  particle_system_config config;
+  config.num_threads = num_threads;
+  config.deterministic = true;
+  config.seed = 1u;
+  config.fixed_elapsed_seconds = elapsed_seconds;
+  config.analytic = analytic;
+
+  particle_system_t particle_system;
+  particle_system.initialise (config);
+
+  long long num_active_particles = 0;
+  suite.run (analytic ? "update_analytic" : "update", { { "threads", (double)num_threads } }, [&]
+    {
+      particle_system.update (elapsed_seconds, num_active_particles);
+      return particle_system.get_num_particles ();
+    });
+
+  particle_system.release ();
+}
+
+/// <summary>
+/// run every microbenchmark & write the results as JSON
+/// </summary>
+static void run_microbenchmarks (float elapsed_seconds)
+{
+  benchmark_suite suite (3u, 20u);
+
+  for (unsigned num_particles : { 1u << 12, 1u << 16, 1u << 20, PARTICLE_MAX })
+  {
+    measure_process (suite, num_particles, elapsed_seconds);
+    measure_update_chunk (suite, num_particles, elapsed_seconds);
+    measure_update_chunk_analytic (suite, num_particles, elapsed_seconds);
+  }
+
+  for (unsigned spawn_rate : { PARTICLE_SPAWN_RATE / 16u, PARTICLE_SPAWN_RATE / 4u, PARTICLE_SPAWN_RATE, PARTICLE_SPAWN_RATE * 4u })
+    measure_emit (suite, spawn_rate, elapsed_seconds);
+
+  for (unsigned num_particles : { 1u << 16, PARTICLE_MAX })
+    measure_draw (suite, num_particles);
+
+  measure_random (suite, 1u << 20);
+
+  // 1, 2, 4, 8 ... up to & including every hardware thread
+  unsigned const max_threads = default_thread_count ();
+  for (unsigned num_threads = 1u; num_threads < max_threads && num_threads <= 8u; num_threads *= 2u)
+    measure_update (suite, num_threads, elapsed_seconds);
+  measure_update (suite, max_threads, elapsed_seconds);
+  measure_update (suite, max_threads, elapsed_seconds, true);
+
+  char const* const path = std::getenv ("SHOT2_BENCHMARK_JSON");
+  char const* const label = std::getenv ("SHOT2_BENCHMARK_LABEL");
+  suite.write_json (path ? path : "Benchmark Results.json", label ? label : "");
+}
+
+/// <summary>
+/// run every benchmark if the SHOT2_BENCHMARK environment variable is set
+/// </summary>
+/// <returns>true, if the benchmarks were run</returns>
+static bool run_benchmarks ()
+{
+  if (!std::getenv ("SHOT2_BENCHMARK"))
+  {
+    return false;
+  }
+
+  float const elapsed_seconds = 1.0f / 60.0f;
+  benchmark_process (PARTICLE_MAX / default_thread_count (), 60u, elapsed_seconds);
+  benchmark_process (PARTICLE_MAX, 60u, elapsed_seconds);
+  benchmark_integrate (PARTICLE_MAX / default_thread_count (), 60u, elapsed_seconds);
+  benchmark_random (PARTICLE_SPAWN_RATE * 5u); // each spawn uses up to 5 random numbers
+  check_vertex_cull ();
+  check_software_renderer ();
+
+  run_microbenchmarks (elapsed_seconds);
+
+  return true;
+}
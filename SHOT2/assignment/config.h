@@ -0,0 +1,179 @@
+// HOW IT WORKS:
+//
+// Run time settings for the particle system.
+// Every setting has a default that matches the normal game, and can be overridden by an environment variable,
+// so the same executable can be reconfigured for profiling/testing without a rebuild:
+//
+//   SHOT2_THREADS        number of worker threads                   (default: one per hardware thread)
+//   SHOT2_WORK_STEALING  0 = threads only process their own chunks  (default: 1)
+//   SHOT2_AFFINITY       pin each thread to its own core or node,    (default: none)
+//                        core | node | none, see thread_placement.h
+//   SHOT2_REPLAY_SEED    enables deterministic replay with this seed (default: off)
+//   SHOT2_FIXED_DT       fixed elapsed seconds per frame             (default: off, 1/60 in replay)
+//   SHOT2_FRAMES         quit after this many frames                 (default: never)
+//   SHOT2_ANALYTIC       1 = evaluate motion from spawn state        (default: 0, integrate every frame)
+//   SHOT2_MAX_PARTICLES  maximum number of particles                 (default: PARTICLE_MAX)
+//   SHOT2_SPAWN_PER_FRAME particles emitted every frame              (default: PARTICLE_SPAWN_RATE)
+//   SHOT2_SPAWN_RATE     particles emitted per second, instead of    (default: off)
+//                        SHOT2_SPAWN_PER_FRAME
+//   SHOT2_HUGE_PAGES     0 = normal pages for the particle storage   (default: 1, see virtual_memory.h)
+//   SHOT2_SHARED_BUDGET  0 = each thread keeps to its own share     (default: 1, always 0 in replay)
+//                        of SHOT2_MAX_PARTICLES & the spawn rate
+//   SHOT2_EMITTERS       INI file of particle types, see particle_types.h (default: the 3 built in types)
+//   SHOT2_TRACE          write a Chrome trace to this file, see profiler.h (default: off)
+//   SHOT2_TRACE_EVENTS   events recorded per thread                  (default: 1 << 18)
+//   SHOT2_PIPELINED      1 = draw each frame while the workers       (default: 0, always 0 in replay)
+//                        simulate the next, see particle_system.h
+//   SHOT2_CULL           drop vertices that would not be seen        (default: none)
+//                        before drawing, none | screen | pixel, see vertex_cull.h
+//   SHOT2_RENDERER       points = SFML point list, software = CPU    (default: points)
+//                        framebuffer, see software_renderer.h
+//   SHOT2_FRAME_DUMP     headless & software only, the last frame    (default: Last Frame)
+//                        is written to this .ppm, without the extension
+//   SHOT2_STATS          frame time statistics files, without the    (default: Frame Times)
+//                        extension, see frame_stats.h
+//   SHOT2_STATS_WINDOW   frames in each statistics window            (default: 600)
+//
+// In deterministic replay every slice's random stream is seeded from SHOT2_REPLAY_SEED & the slice index,
+// and the elapsed time is fixed, so the particle state depends only on the seed, frame number & thread count
+// (never on which thread happened to run which chunk). A checksum of the particle state is written every frame,
+// so the output of two builds can be compared.
+
+
+
+#pragma once
+
+#include "constants.h"
+#include "software_renderer.h"
+#include "thread_placement.h"
+#include "vertex_cull.h"
+
+#include <cstdint>
+#include <cstdlib>  // for std::getenv, std::strtoul, std::strtoull, std::strtof
+#include <cstring>  // for std::strcmp
+
+
+struct particle_system_config
+{
+  unsigned num_threads = 0u;    // 0 = std::thread::hardware_concurrency
+  bool work_stealing = true;
+  thread_affinity affinity = thread_affinity::none;
+
+  bool deterministic = false;
+  std::uint64_t seed = 0u;      // only used when deterministic
+  float fixed_elapsed_seconds = 0.0f; // 0 = measure the frame time
+  unsigned num_frames = 0u;     // 0 = run until the window is closed
+  bool analytic = false;        // see update_chunk_analytic
+  unsigned max_particles = PARTICLE_MAX;
+  unsigned spawn_per_frame = PARTICLE_SPAWN_RATE;
+  float spawn_per_second = 0.0f; // 0 = spawn_per_frame particles every frame, whatever the frame time
+  bool shared_budget = true;    // every thread shares max_particles & the spawn rate, see particle_budget.h
+  bool huge_pages = true;       // see virtual_memory.h
+  char const* emitters_path = nullptr; // nullptr = the built in particle types
+  char const* trace_path = nullptr;    // nullptr = no trace
+  unsigned trace_events = 1u << 18;
+  bool pipelined = false;       // see particle_system.h
+  vertex_cull_mode cull = vertex_cull_mode::none;
+  particle_render_mode render_mode = particle_render_mode::points;
+  char const* frame_dump_path = "Last Frame";
+  char const* stats_path = "Frame Times";
+  unsigned stats_window = 600u;
+};
+
+/// <summary>
+/// build a config from the defaults & any SHOT2_* environment variables
+/// </summary>
+static particle_system_config config_from_environment ()
+{
+  particle_system_config config;
+
+  if (char const* const value = std::getenv ("SHOT2_THREADS"))
+  {
+    config.num_threads = (unsigned)std::strtoul (value, nullptr, 10);
+  }
+  if (char const* const value = std::getenv ("SHOT2_WORK_STEALING"))
+  {
+    config.work_stealing = std::strcmp (value, "0") != 0;
+  }
+  if (char const* const value = std::getenv ("SHOT2_AFFINITY"))
+  {
+    config.affinity = thread_affinity_from_name (value);
+  }
+  if (char const* const value = std::getenv ("SHOT2_REPLAY_SEED"))
+  {
+    config.deterministic = true;
+    config.seed = std::strtoull (value, nullptr, 10);
+    config.fixed_elapsed_seconds = 1.0f / 60.0f;
+  }
+  if (char const* const value = std::getenv ("SHOT2_FIXED_DT"))
+  {
+    config.fixed_elapsed_seconds = std::strtof (value, nullptr);
+  }
+  if (char const* const value = std::getenv ("SHOT2_FRAMES"))
+  {
+    config.num_frames = (unsigned)std::strtoul (value, nullptr, 10);
+  }
+  if (char const* const value = std::getenv ("SHOT2_ANALYTIC"))
+  {
+    config.analytic = std::strcmp (value, "0") != 0;
+  }
+  if (char const* const value = std::getenv ("SHOT2_MAX_PARTICLES"))
+  {
+    unsigned const count = (unsigned)std::strtoul (value, nullptr, 10);
+    config.max_particles = count > 0u ? count : config.max_particles;
+  }
+  if (char const* const value = std::getenv ("SHOT2_SPAWN_PER_FRAME"))
+  {
+    config.spawn_per_frame = (unsigned)std::strtoul (value, nullptr, 10);
+  }
+  if (char const* const value = std::getenv ("SHOT2_SPAWN_RATE"))
+  {
+    config.spawn_per_second = std::strtof (value, nullptr);
+  }
+  if (char const* const value = std::getenv ("SHOT2_SHARED_BUDGET"))
+  {
+    config.shared_budget = std::strcmp (value, "0") != 0;
+  }
+  if (char const* const value = std::getenv ("SHOT2_HUGE_PAGES"))
+  {
+    config.huge_pages = std::strcmp (value, "0") != 0;
+  }
+  if (char const* const value = std::getenv ("SHOT2_EMITTERS"))
+  {
+    config.emitters_path = value;
+  }
+  if (char const* const value = std::getenv ("SHOT2_TRACE"))
+  {
+    config.trace_path = value;
+  }
+  if (char const* const value = std::getenv ("SHOT2_TRACE_EVENTS"))
+  {
+    config.trace_events = (unsigned)std::strtoul (value, nullptr, 10);
+  }
+  if (char const* const value = std::getenv ("SHOT2_PIPELINED"))
+  {
+    config.pipelined = std::strcmp (value, "0") != 0;
+  }
+  if (char const* const value = std::getenv ("SHOT2_CULL"))
+  {
+    config.cull = vertex_cull_mode_from_name (value);
+  }
+  if (char const* const value = std::getenv ("SHOT2_RENDERER"))
+  {
+    config.render_mode = particle_render_mode_from_name (value);
+  }
+  if (char const* const value = std::getenv ("SHOT2_FRAME_DUMP"))
+  {
+    config.frame_dump_path = value;
+  }
+  if (char const* const value = std::getenv ("SHOT2_STATS"))
+  {
+    config.stats_path = value;
+  }
+  if (char const* const value = std::getenv ("SHOT2_STATS_WINDOW"))
+  {
+    config.stats_window = (unsigned)std::strtoul (value, nullptr, 10);
+  }
+
+  return config;
+}
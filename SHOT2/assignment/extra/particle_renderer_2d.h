@@ -40,9 +40,18 @@ public:
 
 
 
-  bool draw (magpie::renderer const& renderer,
+  bool draw (magpie::renderer const& /*renderer*/,
     float position_x, float position_y,
     float colour_r, float colour_g, float colour_b, float colour_a)
+  {
+    return draw (position_x, position_y, colour_r, colour_g, colour_b, colour_a);
+  }
+
+  /// <summary>
+  /// add a vertex, without needing a renderer (e.g. headless)
+  /// </summary>
+  bool draw (float position_x, float position_y,
+    float colour_r, float colour_g, float colour_b, float colour_a)
   {
     if (num_particles == max_particles - 1u)
     {
@@ -55,15 +64,64 @@ public:
     }
 
 
-    vertices [num_particles++] = sf::Vertex (
+    vertices [num_particles++] = make_vertex (position_x, position_y, colour_r, colour_g, colour_b, colour_a);
+
+
+    return true;
+  }
+
+  /// <summary>
+  /// the vertex draw adds for a position & colour
+  /// </summary>
+  static sf::Vertex make_vertex (float position_x, float position_y,
+    float colour_r, float colour_g, float colour_b, float colour_a)
+  {
+    return sf::Vertex (
       sf::Vector2f ((float)position_x, (float)position_y),
       sf::Color ((sf::Uint8)((float)colour_r * (float)UCHAR_MAX), // take colour from between 0 & 1 to 0 & 255
         (sf::Uint8)((float)colour_g * (float)UCHAR_MAX),
         (sf::Uint8)((float)colour_b * (float)UCHAR_MAX),
         (sf::Uint8)((float)colour_a * (float)UCHAR_MAX)));
+  }
+
+  /// <summary>
+  /// claim this frame's vertices, to be written directly rather than with draw (e.g. by worker threads, each to its own range)
+  /// replaces anything already added this frame
+  /// </summary>
+  /// <param name="count">number of vertices that will be written</param>
+  /// <returns>the vertex array, get_num_vertices () long</returns>
+  sf::Vertex* reserve (unsigned count)
+  {
+    if (count > max_particles)
+    {
+      magpie::printf ("There is not enough memory to draw %u particles! Consider increasing max_particles\n", count);
+      count = max_particles;
+    }
 
+    num_particles = count;
+    return vertices.data ();
+  }
 
-    return true;
+  /// <summary>
+  /// throw away this frame's vertices without drawing them (e.g. headless)
+  /// </summary>
+  void discard ()
+  {
+    num_particles = 0u;
+  }
+
+  unsigned get_num_vertices () const
+  {
+    return num_particles;
+  }
+
+  /// <summary>
+  /// free the vertex array, without needing a renderer (e.g. headless)
+  /// </summary>
+  void release ()
+  {
+    vertices.clear ();
+    num_particles = 0u;
   }
 
 
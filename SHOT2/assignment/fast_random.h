@@ -0,0 +1,274 @@
+// HOW IT WORKS:
+//
+// Fast, seedable pseudo random numbers.
+// random_engine is xoshiro128+ (http://prng.di.unimi.it/), 16 bytes of state & a handful of integer ops per number,
+// which is plenty for particle spawn values (it is NOT suitable for anything security related).
+//
+// std::random_device is only read once, to create a base seed.
+// Every thread gets its own engine (thread_local), seeded from the base seed & a per thread counter,
+// so threads never share generator state & never make a system call per number.
+//
+// random_batch_engine runs 4 xoshiro128+ generators side by side, one per SIMD lane,
+// to fill whole arrays of uniform floats at once. The SSE2 & scalar paths produce identical values.
+
+
+
+#pragma once
+
+#include "magpie.h"
+
+#include <atomic>
+#include <cstdint>
+#include <random>  // for std::random_device
+
+#if defined (_M_X64) || defined (_M_IX86) || defined (__x86_64__) || defined (__i386__)
+#include <emmintrin.h> // for SSE2
+#define RANDOM_SSE2 1
+#else
+#define RANDOM_SSE2 0
+#endif // x86
+
+
+/// <summary>
+/// splitmix64, used to turn a single 64 bit seed into well mixed generator state
+/// </summary>
+static std::uint64_t splitmix64 (std::uint64_t& state)
+{
+  std::uint64_t z = (state += 0x9e3779b97f4a7c15ull);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+  return z ^ (z >> 31);
+}
+
+/// <summary>
+/// convert the top 24 bits of a random number to a float in [0, 1)
+/// </summary>
+static float random_to_unit_float (std::uint32_t bits)
+{
+  return (float)(bits >> 8) * (1.0f / 16777216.0f);
+}
+
+/// <summary>
+/// xoshiro128+ generator
+/// </summary>
+struct random_engine
+{
+  random_engine ()
+  {
+    seed (0u);
+  }
+
+  explicit random_engine (std::uint64_t seed_value)
+  {
+    seed (seed_value);
+  }
+
+  void seed (std::uint64_t seed_value)
+  {
+    std::uint64_t const a = splitmix64 (seed_value);
+    std::uint64_t const b = splitmix64 (seed_value);
+    state [0] = (std::uint32_t)a;
+    state [1] = (std::uint32_t)(a >> 32);
+    state [2] = (std::uint32_t)b;
+    state [3] = (std::uint32_t)(b >> 32);
+  }
+
+  std::uint32_t next ()
+  {
+    std::uint32_t const result = state [0] + state [3];
+    std::uint32_t const t = state [1] << 9;
+
+    state [2] ^= state [0];
+    state [3] ^= state [1];
+    state [1] ^= state [2];
+    state [0] ^= state [3];
+    state [2] ^= t;
+    state [3] = (state [3] << 11) | (state [3] >> 21);
+
+    return result;
+  }
+
+  std::uint64_t next64 ()
+  {
+    std::uint64_t const high = next ();
+    return (high << 32) | next ();
+  }
+
+  /// <returns>random number in [min, max)</returns>
+  float uniform (float min, float max)
+  {
+    return min + (max - min) * random_to_unit_float (next ());
+  }
+
+  /// <returns>random number in [min, max]</returns>
+  long long uniform (long long min, long long max)
+  {
+    std::uint64_t const range = (std::uint64_t)max - (std::uint64_t)min + 1u;
+    if (range == 0u) // the full 64 bit range
+    {
+      return (long long)next64 ();
+    }
+    // modulo bias is at most range / 2^64, irrelevant at the ranges used here
+    return (long long)((std::uint64_t)min + next64 () % range);
+  }
+
+  std::uint32_t state [4];
+};
+
+/// <summary>
+/// base seed, read from std::random_device the first time it is needed
+/// </summary>
+static std::uint64_t random_base_seed ()
+{
+  static std::uint64_t const seed = []
+  {
+    std::random_device rd;
+    return ((std::uint64_t)rd () << 32) | rd ();
+  } ();
+  return seed;
+}
+
+/// <summary>
+/// the calling thread's own generator
+/// </summary>
+static random_engine& thread_random_engine ()
+{
+  static std::atomic <std::uint64_t> next_thread = { 0u };
+  thread_local random_engine engine (random_base_seed () ^ (next_thread.fetch_add (1u) * 0x9e3779b97f4a7c15ull));
+  return engine;
+}
+
+
+/// <summary>
+/// 4 xoshiro128+ generators, one per SIMD lane, for filling arrays of random numbers
+/// state is stored a word at a time across the lanes, so each SSE2 register holds one word of all 4 generators
+/// </summary>
+struct random_batch_engine
+{
+  static unsigned const LANES = 4u;
+
+  random_batch_engine ()
+  {
+    seed (0u);
+  }
+
+  explicit random_batch_engine (std::uint64_t seed_value)
+  {
+    seed (seed_value);
+  }
+
+  void seed (std::uint64_t seed_value)
+  {
+    for (unsigned lane = 0u; lane < LANES; ++lane)
+    {
+      random_engine const engine (splitmix64 (seed_value));
+      for (unsigned word = 0u; word < 4u; ++word)
+      {
+        state [word][lane] = engine.state [word];
+      }
+    }
+  }
+
+  /// <summary>
+  /// fill values with uniform random numbers in [min, max)
+  /// </summary>
+  /// <param name="values">array to fill</param>
+  /// <param name="count">number of values to write</param>
+  /// <param name="min">minimum value (inclusive)</param>
+  /// <param name="max">maximum value (exclusive)</param>
+  void fill (float* values, unsigned count, float min, float max)
+  {
+    MAGPIE_DASSERT (max >= min);
+
+    unsigned const batched_count = count & ~(LANES - 1u);
+#if RANDOM_SSE2
+    __m128i s0 = _mm_loadu_si128 ((__m128i const*)state [0]);
+    __m128i s1 = _mm_loadu_si128 ((__m128i const*)state [1]);
+    __m128i s2 = _mm_loadu_si128 ((__m128i const*)state [2]);
+    __m128i s3 = _mm_loadu_si128 ((__m128i const*)state [3]);
+    __m128 const scale = _mm_set1_ps ((max - min) * (1.0f / 16777216.0f));
+    __m128 const offset = _mm_set1_ps (min);
+
+    for (unsigned i = 0u; i < batched_count; i += LANES)
+    {
+      __m128i const result = _mm_add_epi32 (s0, s3);
+      __m128i const t = _mm_slli_epi32 (s1, 9);
+      s2 = _mm_xor_si128 (s2, s0);
+      s3 = _mm_xor_si128 (s3, s1);
+      s1 = _mm_xor_si128 (s1, s2);
+      s0 = _mm_xor_si128 (s0, s3);
+      s2 = _mm_xor_si128 (s2, t);
+      s3 = _mm_or_si128 (_mm_slli_epi32 (s3, 11), _mm_srli_epi32 (s3, 21));
+
+      // top 24 bits convert to float exactly
+      __m128 const unit = _mm_cvtepi32_ps (_mm_srli_epi32 (result, 8));
+      _mm_storeu_ps (values + i, _mm_add_ps (offset, _mm_mul_ps (unit, scale)));
+    }
+
+    _mm_storeu_si128 ((__m128i*)state [0], s0);
+    _mm_storeu_si128 ((__m128i*)state [1], s1);
+    _mm_storeu_si128 ((__m128i*)state [2], s2);
+    _mm_storeu_si128 ((__m128i*)state [3], s3);
+#else
+    for (unsigned i = 0u; i < batched_count; i += LANES)
+    {
+      float group [LANES];
+      next_group (group, min, max);
+      for (unsigned lane = 0u; lane < LANES; ++lane)
+        values [i + lane] = group [lane];
+    }
+#endif // RANDOM_SSE2
+
+    // remainder, a whole group is generated so the lanes stay in step
+    if (batched_count < count)
+    {
+      float group [LANES];
+      next_group (group, min, max);
+      for (unsigned i = batched_count; i < count; ++i)
+        values [i] = group [i - batched_count];
+    }
+  }
+
+  std::uint32_t state [4][LANES];
+
+private:
+  /// <summary>
+  /// step every lane once, the scalar equivalent of a single SSE2 iteration
+  /// </summary>
+  void next_group (float group [LANES], float min, float max)
+  {
+    float const scale = (max - min) * (1.0f / 16777216.0f);
+    for (unsigned lane = 0u; lane < LANES; ++lane)
+    {
+      std::uint32_t const result = state [0][lane] + state [3][lane];
+      std::uint32_t const t = state [1][lane] << 9;
+      state [2][lane] ^= state [0][lane];
+      state [3][lane] ^= state [1][lane];
+      state [1][lane] ^= state [2][lane];
+      state [0][lane] ^= state [3][lane];
+      state [2][lane] ^= t;
+      state [3][lane] = (state [3][lane] << 11) | (state [3][lane] >> 21);
+
+      group [lane] = min + (float)(result >> 8) * scale;
+    }
+  }
+};
+
+/// <summary>
+/// the calling thread's own batch generator
+/// </summary>
+static random_batch_engine& thread_random_batch_engine ()
+{
+  static std::atomic <std::uint64_t> next_thread = { 0u };
+  thread_local random_batch_engine engine (random_base_seed () ^ ~(next_thread.fetch_add (1u) * 0x9e3779b97f4a7c15ull));
+  return engine;
+}
+
+/// <summary>
+/// fill values with uniform random numbers in [min, max) using the calling thread's batch generator
+/// (inline, it is only used by the benchmarks, emit fills its arrays from its own random_batch_engine)
+/// </summary>
+inline void random_fill (float* values, unsigned count, float min, float max)
+{
+  thread_random_batch_engine ().fill (values, count, min, max);
+}
@@ -0,0 +1,376 @@
+// HOW IT WORKS:
+//
+// Streaming frame time statistics, in constant memory however long the game runs.
+//
+// Every frame's time for each phase (the whole frame, emit, update & render) goes into a latency_histogram:
+// log-linear buckets in the style of an HDR histogram, 64 linear buckets for every power of two of nanoseconds,
+// so any value is within 1/64 (~1.6%) of its bucket at any scale, from nanoseconds to minutes, in 3776 counters.
+// Percentiles (p50, p99, p99.9) are read by walking the buckets, recording a frame is a couple of shifts & an increment.
+//
+// Each phase has two histograms: the whole run, and the current window of SHOT2_STATS_WINDOW frames (default 600).
+// At the end of every window, the window's & the whole run's summaries are handed to a background writer thread,
+// which appends the window to '<SHOT2_STATS>.csv' & rewrites '<SHOT2_STATS>.json' with the whole run (default 'Frame Times'),
+// so the game loop never waits on file I/O, and a soak run shows how the tail latency changes over time.
+// The window's histograms are then cleared for the next window, and whatever is left of the last window is written by release.
+
+
+
+#pragma once
+
+#include "magpie.h"
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>   // for std::snprintf
+#include <fstream>  // for std::ofstream
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+/// <summary>
+/// log-linear histogram of nanosecond latencies, see the top of this file
+/// </summary>
+class latency_histogram
+{
+public:
+  static unsigned const SUB_BUCKETS = 128u; // values below this have a bucket each, then 64 buckets per power of two
+  static unsigned const NUM_BUCKETS = (64u - 7u) * (SUB_BUCKETS / 2u) + SUB_BUCKETS;
+
+  void record (std::uint64_t value_ns)
+  {
+    counts [bucket (value_ns)]++;
+    total++;
+    sum += value_ns;
+    min = value_ns < min ? value_ns : min;
+    max = value_ns > max ? value_ns : max;
+  }
+
+  void reset ()
+  {
+    for (std::uint64_t& count : counts)
+    {
+      count = 0u;
+    }
+    total = sum = max = 0u;
+    min = ~0ull;
+  }
+
+  /// <summary>
+  /// value that fraction of the recorded values are at or below, to within a bucket
+  /// </summary>
+  /// <param name="fraction">0 <-> 1, e.g. 0.99 for p99</param>
+  std::uint64_t percentile (double fraction) const
+  {
+    if (total == 0u)
+    {
+      return 0u;
+    }
+
+    std::uint64_t const rank = (std::uint64_t)(fraction * (double)(total - 1u)) + 1u;
+    std::uint64_t seen = 0u;
+    for (unsigned i = 0u; i < NUM_BUCKETS; ++i)
+    {
+      seen += counts [i];
+      if (seen >= rank)
+      {
+        // middle of the bucket, kept within what was actually recorded
+        std::uint64_t const value = bucket_middle (i);
+        return value < min ? min : value > max ? max : value;
+      }
+    }
+    return max;
+  }
+
+  std::uint64_t get_count () const { return total; }
+  std::uint64_t get_min () const { return total > 0u ? min : 0u; }
+  std::uint64_t get_max () const { return max; }
+  double get_mean () const { return total > 0u ? (double)sum / (double)total : 0.0; }
+
+private:
+  static unsigned bucket (std::uint64_t value)
+  {
+    // keep the top 7 bits, the shift picks the power of two
+    unsigned shift = 0u;
+    while (value >= SUB_BUCKETS)
+    {
+      value >>= 1;
+      shift++;
+    }
+    return shift * (SUB_BUCKETS / 2u) + (unsigned)value;
+  }
+
+  static std::uint64_t bucket_middle (unsigned index)
+  {
+    if (index < SUB_BUCKETS)
+    {
+      return index;
+    }
+    unsigned const shift = (index - SUB_BUCKETS / 2u) / (SUB_BUCKETS / 2u);
+    std::uint64_t const low = (std::uint64_t)(index - shift * (SUB_BUCKETS / 2u)) << shift;
+    return low + ((1ull << shift) >> 1);
+  }
+
+  std::uint64_t counts [NUM_BUCKETS] = {};
+  std::uint64_t total = 0u, sum = 0u;
+  std::uint64_t min = ~0ull, max = 0u;
+};
+
+/// <summary>
+/// the phases of a frame that are timed
+/// </summary>
+enum frame_phase : unsigned
+{
+  frame_phase_frame = 0u, // frame start to frame start
+  frame_phase_emit,
+  frame_phase_update,
+  frame_phase_render,
+  NUM_FRAME_PHASES,
+};
+
+static char const* const FRAME_PHASE_NAMES [NUM_FRAME_PHASES] = { "frame", "emit", "update", "render" };
+
+/// <summary>
+/// a histogram's summary, in milliseconds
+/// </summary>
+struct latency_summary
+{
+  unsigned long long count = 0u;
+  double mean_ms = 0.0, min_ms = 0.0, max_ms = 0.0;
+  double p50_ms = 0.0, p99_ms = 0.0, p999_ms = 0.0;
+
+  static latency_summary of (latency_histogram const& histogram)
+  {
+    latency_summary summary;
+    summary.count = histogram.get_count ();
+    summary.mean_ms = histogram.get_mean () / 1e6;
+    summary.min_ms = (double)histogram.get_min () / 1e6;
+    summary.max_ms = (double)histogram.get_max () / 1e6;
+    summary.p50_ms = (double)histogram.percentile (0.5) / 1e6;
+    summary.p99_ms = (double)histogram.percentile (0.99) / 1e6;
+    summary.p999_ms = (double)histogram.percentile (0.999) / 1e6;
+    return summary;
+  }
+};
+
+/// <summary>
+/// everything the writer needs for one window, copied so the game loop can carry on straight away
+/// </summary>
+struct frame_stats_snapshot
+{
+  unsigned window = 0u;
+  unsigned long long first_frame = 0u, end_frame = 0u; // frames [first_frame, end_frame)
+  latency_summary window_phases [NUM_FRAME_PHASES];
+  latency_summary total_phases [NUM_FRAME_PHASES];
+};
+
+/// <summary>
+/// writes snapshots to the CSV & JSON files on its own thread
+/// </summary>
+class frame_stats_writer
+{
+public:
+  frame_stats_writer () = default;
+  frame_stats_writer (frame_stats_writer const&) = delete;
+  frame_stats_writer& operator= (frame_stats_writer const&) = delete;
+  ~frame_stats_writer ()
+  {
+    stop ();
+  }
+
+  void start (std::string const& path)
+  {
+    csv_path = path + ".csv";
+    json_path = path + ".json";
+    quit = false;
+    thread = std::thread (&frame_stats_writer::thread_main, this);
+  }
+
+  /// <summary>
+  /// queue a snapshot to be written, never waits for the file I/O
+  /// </summary>
+  void submit (frame_stats_snapshot const& snapshot)
+  {
+    {
+      std::lock_guard <std::mutex> lock (mutex);
+      if (pending.size () >= MAX_PENDING)
+      {
+        dropped++; // the writer has fallen far behind, the next snapshot still has the whole run
+        return;
+      }
+      pending.push_back (snapshot);
+    }
+    wake.notify_one ();
+  }
+
+  /// <summary>
+  /// write anything still queued & stop the thread
+  /// </summary>
+  void stop ()
+  {
+    if (!thread.joinable ())
+    {
+      return;
+    }
+    {
+      std::lock_guard <std::mutex> lock (mutex);
+      quit = true;
+    }
+    wake.notify_one ();
+    thread.join ();
+  }
+
+private:
+  static size_t const MAX_PENDING = 64u;
+
+  void thread_main ()
+  {
+    std::ofstream csv (csv_path);
+    csv << "window,first_frame,end_frame,phase,count,mean_ms,min_ms,max_ms,p50_ms,p99_ms,p999_ms\n";
+
+    std::vector <frame_stats_snapshot> writing;
+    for (;;)
+    {
+      {
+        std::unique_lock <std::mutex> lock (mutex);
+        wake.wait (lock, [this] { return quit || !pending.empty (); });
+        if (pending.empty () && quit)
+        {
+          break;
+        }
+        writing.swap (pending);
+      }
+
+      char line [256];
+      for (frame_stats_snapshot const& snapshot : writing)
+      {
+        for (unsigned phase = 0u; phase < NUM_FRAME_PHASES; ++phase)
+        {
+          latency_summary const& s = snapshot.window_phases [phase];
+          std::snprintf (line, sizeof (line), "%u,%llu,%llu,%s,%llu,%.4f,%.4f,%.4f,%.4f,%.4f,%.4f\n",
+            snapshot.window, snapshot.first_frame, snapshot.end_frame, FRAME_PHASE_NAMES [phase],
+            s.count, s.mean_ms, s.min_ms, s.max_ms, s.p50_ms, s.p99_ms, s.p999_ms);
+          csv << line;
+        }
+      }
+      csv.flush ();
+
+      // the whole run so far, rewritten each time so the file is always complete
+      if (!writing.empty ())
+      {
+        frame_stats_snapshot const& latest = writing.back ();
+        std::ofstream json (json_path);
+        json << "{\n  \"frames\": " << latest.end_frame << ",\n  \"windows\": " << latest.window + 1u << ",\n  \"phases\": {";
+        for (unsigned phase = 0u; phase < NUM_FRAME_PHASES; ++phase)
+        {
+          latency_summary const& s = latest.total_phases [phase];
+          std::snprintf (line, sizeof (line),
+            "%s\n    \"%s\": { \"count\": %llu, \"mean_ms\": %.4f, \"min_ms\": %.4f, \"max_ms\": %.4f, "
+            "\"p50_ms\": %.4f, \"p99_ms\": %.4f, \"p999_ms\": %.4f }",
+            phase > 0u ? "," : "", FRAME_PHASE_NAMES [phase], s.count, s.mean_ms, s.min_ms, s.max_ms, s.p50_ms, s.p99_ms, s.p999_ms);
+          json << line;
+        }
+        json << "\n  }\n}\n";
+      }
+      writing.clear ();
+    }
+
+    if (dropped > 0u)
+    {
+      magpie::printf ("frame stats: %u windows not written, the writer fell behind\n", dropped);
+    }
+  }
+
+  std::string csv_path, json_path;
+  std::thread thread;
+  std::mutex mutex; // guards pending, quit & dropped
+  std::condition_variable wake;
+  std::vector <frame_stats_snapshot> pending;
+  unsigned dropped = 0u;
+  bool quit = false;
+};
+
+/// <summary>
+/// per phase frame time histograms for the whole run & the current window, see the top of this file
+/// </summary>
+class frame_stats
+{
+public:
+  /// <param name="path">file path without extension, '.csv' & '.json' are written</param>
+  /// <param name="window_frames">frames in each window</param>
+  void initialise (std::string const& path, unsigned window_frames)
+  {
+    this->window_frames = window_frames > 0u ? window_frames : 1u;
+    writer.start (path);
+    magpie::printf ("frame stats: %u frame windows, written to '%s.csv' & '%s.json'\n",
+      this->window_frames, path.c_str (), path.c_str ());
+  }
+
+  /// <summary>
+  /// record one phase of the current frame
+  /// </summary>
+  void record (frame_phase phase, float milliseconds)
+  {
+    std::uint64_t const value_ns = milliseconds > 0.0f ? (std::uint64_t)((double)milliseconds * 1e6) : 0u;
+    total [phase].record (value_ns);
+    window [phase].record (value_ns);
+  }
+
+  /// <summary>
+  /// call once every phase of the frame has been recorded, hands the window to the writer when it is complete
+  /// </summary>
+  void end_frame ()
+  {
+    if (++num_frames - window_first_frame >= window_frames)
+    {
+      flush_window ();
+    }
+  }
+
+  /// <summary>
+  /// the whole run's histogram for a phase
+  /// </summary>
+  latency_histogram const& get_total (frame_phase phase) const
+  {
+    return total [phase];
+  }
+
+  /// <summary>
+  /// write the last part window & finish writing
+  /// </summary>
+  void release ()
+  {
+    if (num_frames > window_first_frame)
+    {
+      flush_window ();
+    }
+    writer.stop ();
+  }
+
+private:
+  /// <summary>
+  /// hand the current window to the writer & start the next
+  /// </summary>
+  void flush_window ()
+  {
+    frame_stats_snapshot snapshot;
+    snapshot.window = window_index++;
+    snapshot.first_frame = window_first_frame;
+    snapshot.end_frame = num_frames;
+    for (unsigned phase = 0u; phase < NUM_FRAME_PHASES; ++phase)
+    {
+      snapshot.window_phases [phase] = latency_summary::of (window [phase]);
+      snapshot.total_phases [phase] = latency_summary::of (total [phase]);
+      window [phase].reset ();
+    }
+    writer.submit (snapshot);
+    window_first_frame = num_frames;
+  }
+
+  latency_histogram total [NUM_FRAME_PHASES];
+  latency_histogram window [NUM_FRAME_PHASES];
+  unsigned long long num_frames = 0u, window_first_frame = 0u;
+  unsigned window_frames = 600u, window_index = 0u;
+  frame_stats_writer writer;
+};
@@ -1,7 +1,8 @@
 // APP NOTES:
 //
 // Simple CPU particle simulation.
-// This is a small graphical application in which 3 types of particle are emitted from separate locations,
+// This is a small graphical application in which 3 types of particle (or the types in SHOT2_EMITTERS, see particle_types.h)
+// are emitted from separate locations,
 // with differing position offsets, velocities, accelerations and start & end colours.
 // Each particle is represented by a single pixel.
 // Go to 'particle_system.h' for more details.
@@ -79,7 +80,13 @@
 
 #include "magpie.h"          // for magpie window/rendering components
 #include "timer.h"
+#include "frame_stats.h"     // for frame_stats
+#include "benchmark.h"       // for run_benchmarks
+#include "profiler.h"        // for PROFILE_FRAME, PROFILE_ZONE
 
+#include "config.h"          // for config_from_environment
+
+#include <fstream>           // for std::ofstream
 #include <string>            // for variables with words
 
 
@@ -110,14 +117,28 @@ ENTRY_POINT
 
 
   // SETUP
+  run_benchmarks (); // only if SHOT2_BENCHMARK is set
+
+  // SHOT2_* environment variables override the defaults, see config.h
+  particle_system_config const config = config_from_environment ();
+
   particle_system_t particle_system;
-  if (!particle_system.initialise (renderer))
+  if (!particle_system.initialise (renderer, config))
   {
     MAGPIE_DASSERT (false);
 
   }
 
+  // deterministic replay writes a checksum of the particle state every frame
+  std::ofstream checksum_file;
+  if (config.deterministic)
+  {
+    checksum_file.open ("Replay Checksums.csv");
+    checksum_file << "frame,particles,checksum" << std::endl;
+  }
+
   long long num_active_particles = 0;
+  unsigned frame_count = 0u;
 
 
   //// frame timer
@@ -130,33 +151,95 @@ ENTRY_POINT
   //// have really small first frame elapsed seconds, rather than an unknown time
 
 
+  // frame time percentiles per phase, written in the background every SHOT2_STATS_WINDOW frames
+  frame_stats stats;
+  stats.initialise (config.stats_path, config.stats_window);
+
+
   // GAME LOOP
   Timer frametimer;
-  timer_average avgTime;
+  Timer render_timer;
   frametimer.start();
   while (renderer.process_os_messages ())
   {
+    PROFILE_FRAME ("main");
+
     //QueryPerformanceCounter (&qpc_end); // end frame timer
     //float const elapsed_seconds = (float)(qpc_end.QuadPart - qpc_start.QuadPart) / timer_multiplier_secs;
     //magpie::printf ("FPS = %.2f - elapsed = %.5fs",
     //  1.0f / elapsed_seconds, // FPS
     //  elapsed_seconds);      // last frame time
     //QueryPerformanceCounter (&qpc_start); // start frame timer
-      avgTime.start();
-
       frametimer.stop();
       float elapsed_seconds = frametimer.get_elapsed_s();
       frametimer.start();
+      if (frame_count > 0u) // the first frame's time is only the set up
+      {
+        stats.record (frame_phase_frame, elapsed_seconds * 1000.0f);
+      }
+      if (config.fixed_elapsed_seconds > 0.0f)
+      {
+        elapsed_seconds = config.fixed_elapsed_seconds;
+      }
 
 
     // UPDATE
     {
+      PROFILE_ZONE ("frame update");
       particle_system.update (elapsed_seconds, num_active_particles);
+      ++frame_count;
+      stats.record (frame_phase_emit, particle_system.get_timings ().emit_ms);
+      stats.record (frame_phase_update, particle_system.get_timings ().update_ms);
+
+      if (config.deterministic)
+      {
+        checksum_file << frame_count << "," << particle_system.get_num_particles () << ","
+          << std::hex << particle_system.get_checksum () << std::dec << "\n";
+      }
+
+      // once a second (ish), how evenly the update was shared between threads & how many heap allocations it made (should be 0)
+      // & the particle count & cost per particle, printing every frame would cost more than the update
+      if (frame_count % 60u == 0u)
+      {
+        magpie::printf ("load imbalance = %.2f (%u of %u chunks stolen), heap allocations = %u\n",
+          particle_system.get_load_imbalance (),
+          particle_system.get_chunks_stolen (),
+          particle_system.get_num_chunks (),
+          particle_system.get_heap_allocations ());
+
+        particle_system_t::frame_counts const& counts = particle_system.get_counts ();
+        magpie::printf ("number of active particles = %lld (%u spawned, %u killed), All paricles are active: %s, ns/P = %.2f\n",
+          num_active_particles,                                             // number of active particles
+          counts.num_spawned, counts.num_killed,                            // turnover in the last update
+          num_active_particles == (long long)particle_system.get_max_particles () ? "YES" : "NO", // all particles are active?
+          num_active_particles > 0 ? elapsed_seconds * 1'000'000'000.f / (float)num_active_particles : 0.0f); // time (ns) per particle
+        if (config.render_mode == particle_render_mode::software)
+        {
+          magpie::printf ("software renderer: %u of %u vertices on screen, rasterised in %.2f ms\n",
+            counts.num_drawn, counts.num_vertices, particle_system.get_timings ().raster_ms);
+        }
+        else if (config.cull != vertex_cull_mode::none)
+        {
+          magpie::printf ("vertices drawn = %u of %u (culled %s in %.2f ms)\n",
+            counts.num_drawn, counts.num_vertices, vertex_cull_mode_name (config.cull), particle_system.get_timings ().cull_ms);
+        }
+
+        // on machines with more than one memory node, each node's share of the update's bandwidth, see thread_placement.h
+        std::vector <particle_system_t::node_traffic> const nodes = particle_system.get_node_traffic ();
+        for (size_t i = 0u; nodes.size () > 1u && i < nodes.size (); ++i)
+        {
+          magpie::printf ("node %u: %u threads, ~%.2f GB/s, %llu of %llu chunks on another node's memory\n", (unsigned)i,
+            nodes [i].num_threads, nodes [i].gigabytes_per_second, nodes [i].remote_chunks, nodes [i].local_chunks + nodes [i].remote_chunks);
+        }
+      }
     }
 
 
     // RENDER
     {
+      PROFILE_ZONE ("frame render");
+      render_timer.start ();
+
       ////////////////////////////////////////////////
       //// DO NOT EDIT/DELETE/MOVE CODE BELOW >>> ////
       ////////////////////////////////////////////////
@@ -192,20 +275,23 @@ ENTRY_POINT
       ////////////////////////////////////////////////
       //// <<< DO NOT EDIT/DELETE/MOVE CODE ABOVE ////
       ////////////////////////////////////////////////
+
+      render_timer.stop ();
+      stats.record (frame_phase_render, render_timer.get_elapsed_ms ());
     }
 
+    stats.end_frame ();
 
-    //magpie::printf ("\nnumber of active particles = %d, All paricles are active: %s, ns/P = %.2f\n",
-    //  num_active_particles,                                             // number of active particles
-    //  num_active_particles == PARTICLE_MAX ? "YES" : "NO",              // all particles are active?
-    //  elapsed_seconds * 1'000'000'000.f / (float)num_active_particles); // time (ns) per particle
-    avgTime.stop();
-    avgTime.print_to_file();
+    if (config.num_frames > 0u && frame_count == config.num_frames)
+    {
+      break;
+    }
   }
 
 
   // RELEASE RESOURCES
   {
+    stats.release ();
     particle_system.release (renderer);
 
 
@@ -0,0 +1,356 @@
+// HOW IT WORKS:
+//
+// A small microbenchmark harness, used by 'benchmark.h'.
+// benchmark_suite::run calls a benchmark's body a number of times:
+//   warm-up repetitions - run but not recorded, so caches, branch predictors & lazily allocated memory settle first
+//   measured repetitions - each one timed on its own, so the spread of times can be reported, not just the mean
+// A setup callable runs before every repetition & is never timed (e.g. to reset particles to the same starting state).
+// The body returns the number of items (particles, random numbers, etc.) it processed,
+// so every result is reported as time per item & the benchmarks stay comparable across sizes.
+//
+// Each result holds the min/mean/max & the 50th, 90th & 99th percentile time per item over the measured repetitions.
+//
+// On Linux, hardware counters (cycles, instructions, cache misses & branch misses) are read with perf_event_open
+// around each measured repetition. Only the calling thread is counted, so for multi threaded benchmarks
+// the counters cover the main thread's share of the work only.
+// If the counters are unavailable (other platforms, containers, perf_event_paranoid, etc.) they are simply left out.
+//
+// write_json writes every result to a JSON file, so results can be compared across commits by a script.
+
+
+
+#pragma once
+
+#include "magpie.h"
+
+#include <algorithm> // for std::sort
+#include <chrono>
+#include <cstdint>
+#include <fstream>   // for std::ofstream
+#include <iomanip>   // for std::setprecision
+#include <initializer_list>
+#include <string>    // for variables with words
+#include <vector>
+
+#if defined (__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#define BENCHMARK_PERF_EVENTS 1
+#else
+#define BENCHMARK_PERF_EVENTS 0
+#endif // __linux__
+
+
+/// <summary>
+/// hardware counter totals
+/// </summary>
+struct hardware_counter_values
+{
+  std::uint64_t cycles = 0u;
+  std::uint64_t instructions = 0u;
+  std::uint64_t cache_misses = 0u;
+  std::uint64_t branch_misses = 0u;
+
+  hardware_counter_values& operator+= (hardware_counter_values const& other)
+  {
+    cycles += other.cycles;
+    instructions += other.instructions;
+    cache_misses += other.cache_misses;
+    branch_misses += other.branch_misses;
+    return *this;
+  }
+};
+
+/// <summary>
+/// hardware counters for the calling thread, a no-op where perf_event_open is not available
+/// </summary>
+class hardware_counters
+{
+public:
+  hardware_counters ()
+  {
+#if BENCHMARK_PERF_EVENTS
+    std::uint64_t const configs [NUM_COUNTERS] = { PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+      PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES };
+
+    // one group, so all the counters are started, stopped & read together
+    for (unsigned i = 0u; i < NUM_COUNTERS; ++i)
+    {
+      perf_event_attr attr = {};
+      attr.type = PERF_TYPE_HARDWARE;
+      attr.size = sizeof (attr);
+      attr.config = configs [i];
+      attr.disabled = i == 0u ? 1 : 0; // the group leader starts & stops the group
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+      attr.read_format = PERF_FORMAT_GROUP;
+
+      files [i] = (int)syscall (SYS_perf_event_open, &attr, 0, -1, i == 0u ? -1 : files [0], 0);
+      if (files [i] < 0)
+      {
+        close_files ();
+        return;
+      }
+    }
+#endif // BENCHMARK_PERF_EVENTS
+  }
+
+  hardware_counters (hardware_counters const&) = delete;
+  hardware_counters& operator= (hardware_counters const&) = delete;
+  ~hardware_counters ()
+  {
+    close_files ();
+  }
+
+  /// <returns>true, if the counters could be opened</returns>
+  bool available () const
+  {
+    return files [0] >= 0;
+  }
+
+  void start ()
+  {
+#if BENCHMARK_PERF_EVENTS
+    if (available ())
+    {
+      ioctl (files [0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+      ioctl (files [0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+#endif // BENCHMARK_PERF_EVENTS
+  }
+
+  /// <returns>counts since start</returns>
+  hardware_counter_values stop ()
+  {
+    hardware_counter_values values;
+#if BENCHMARK_PERF_EVENTS
+    if (available ())
+    {
+      ioctl (files [0], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+
+      // PERF_FORMAT_GROUP layout: number of counters, then each counter's value
+      std::uint64_t buffer [1u + NUM_COUNTERS] = {};
+      if (read (files [0], buffer, sizeof (buffer)) == (ssize_t)sizeof (buffer) && buffer [0] == NUM_COUNTERS)
+      {
+        values.cycles = buffer [1];
+        values.instructions = buffer [2];
+        values.cache_misses = buffer [3];
+        values.branch_misses = buffer [4];
+      }
+    }
+#endif // BENCHMARK_PERF_EVENTS
+    return values;
+  }
+
+private:
+  void close_files ()
+  {
+    for (int& file : files)
+    {
+#if BENCHMARK_PERF_EVENTS
+      if (file >= 0)
+      {
+        close (file);
+      }
+#endif // BENCHMARK_PERF_EVENTS
+      file = -1;
+    }
+  }
+
+  static unsigned const NUM_COUNTERS = 4u;
+  int files [NUM_COUNTERS] = { -1, -1, -1, -1 };
+};
+
+/// <summary>
+/// a named value describing a benchmark run, e.g. { "particles", 65536 }
+/// </summary>
+struct benchmark_parameter
+{
+  char const* name;
+  double value;
+};
+
+/// <summary>
+/// summary of one benchmark's measured repetitions
+/// </summary>
+struct benchmark_result
+{
+  std::string name;
+  std::vector <benchmark_parameter> parameters;
+
+  unsigned repetitions = 0u;
+  double items = 0.0;   // total items processed over the measured repetitions
+
+  // time (ns) per item
+  double min_ns = 0.0, mean_ns = 0.0, max_ns = 0.0;
+  double p50_ns = 0.0, p90_ns = 0.0, p99_ns = 0.0;
+
+  bool has_counters = false;
+  hardware_counter_values counters; // totals over the measured repetitions
+};
+
+class benchmark_suite
+{
+public:
+  /// <param name="warmup_repetitions">repetitions run before timing starts</param>
+  /// <param name="measured_repetitions">repetitions timed</param>
+  benchmark_suite (unsigned warmup_repetitions, unsigned measured_repetitions)
+    : warmup_repetitions (warmup_repetitions), measured_repetitions (measured_repetitions)
+  {
+    MAGPIE_DASSERT_MSG (measured_repetitions > 0u, "measured_repetitions must be greater than 0");
+  }
+
+  /// <summary>
+  /// run & record a benchmark
+  /// </summary>
+  /// <param name="name">benchmark name</param>
+  /// <param name="parameters">values describing this run</param>
+  /// <param name="setup">called before every repetition, not timed</param>
+  /// <param name="body">the code to time, returns the number of items processed</param>
+  template <typename setup_t, typename body_t>
+  benchmark_result const& run (char const* name, std::initializer_list <benchmark_parameter> parameters,
+    setup_t&& setup, body_t&& body)
+  {
+    for (unsigned repetition = 0u; repetition < warmup_repetitions; ++repetition)
+    {
+      setup ();
+      body ();
+    }
+
+    benchmark_result result;
+    result.name = name;
+    result.parameters = parameters;
+    result.repetitions = measured_repetitions;
+    result.has_counters = counters.available ();
+
+    std::vector <double> ns_per_item;
+    ns_per_item.reserve (measured_repetitions);
+    double total_ns = 0.0;
+    for (unsigned repetition = 0u; repetition < measured_repetitions; ++repetition)
+    {
+      setup ();
+
+      counters.start ();
+      auto const start = std::chrono::steady_clock::now ();
+      double const items = (double)body ();
+      auto const end = std::chrono::steady_clock::now ();
+      result.counters += counters.stop ();
+
+      double const ns = std::chrono::duration <double, std::nano> (end - start).count ();
+      total_ns += ns;
+      result.items += items;
+      ns_per_item.push_back (items > 0.0 ? ns / items : 0.0);
+    }
+
+    std::sort (ns_per_item.begin (), ns_per_item.end ());
+    result.min_ns = ns_per_item.front ();
+    result.max_ns = ns_per_item.back ();
+    result.mean_ns = result.items > 0.0 ? total_ns / result.items : 0.0;
+    result.p50_ns = percentile (ns_per_item, 50.0);
+    result.p90_ns = percentile (ns_per_item, 90.0);
+    result.p99_ns = percentile (ns_per_item, 99.0);
+
+    print (result);
+    results.push_back (std::move (result));
+    return results.back ();
+  }
+
+  /// <summary>
+  /// run & record a benchmark that needs no setup
+  /// </summary>
+  template <typename body_t>
+  benchmark_result const& run (char const* name, std::initializer_list <benchmark_parameter> parameters, body_t&& body)
+  {
+    return run (name, parameters, [] {}, body);
+  }
+
+  /// <summary>
+  /// write every result recorded so far as JSON
+  /// </summary>
+  /// <param name="path">file to write</param>
+  /// <param name="label">free text stored with the results, e.g. a commit hash</param>
+  /// <returns>true, if the file was written</returns>
+  bool write_json (char const* path, char const* label) const
+  {
+    std::ofstream file (path);
+    if (!file.is_open ())
+    {
+      magpie::printf ("unable to write benchmark results to %s\n", path);
+      return false;
+    }
+
+    file << std::setprecision (12);
+    file << "{\n";
+    file << "  \"label\": \"" << label << "\",\n";
+    file << "  \"warmup_repetitions\": " << warmup_repetitions << ",\n";
+    file << "  \"measured_repetitions\": " << measured_repetitions << ",\n";
+    file << "  \"results\": [";
+    for (size_t i = 0u; i < results.size (); ++i)
+    {
+      benchmark_result const& result = results [i];
+      file << (i == 0u ? "\n" : ",\n");
+      file << "    {\n";
+      file << "      \"name\": \"" << result.name << "\",\n";
+      file << "      \"parameters\": {";
+      for (size_t p = 0u; p < result.parameters.size (); ++p)
+      {
+        file << (p == 0u ? " " : ", ") << "\"" << result.parameters [p].name << "\": " << result.parameters [p].value;
+      }
+      file << " },\n";
+      file << "      \"items\": " << result.items << ",\n";
+      file << "      \"ns_per_item\": { \"min\": " << result.min_ns << ", \"mean\": " << result.mean_ns
+        << ", \"p50\": " << result.p50_ns << ", \"p90\": " << result.p90_ns << ", \"p99\": " << result.p99_ns
+        << ", \"max\": " << result.max_ns << " },\n";
+      if (result.has_counters)
+      {
+        file << "      \"counters\": { \"cycles\": " << result.counters.cycles
+          << ", \"instructions\": " << result.counters.instructions
+          << ", \"cache_misses\": " << result.counters.cache_misses
+          << ", \"branch_misses\": " << result.counters.branch_misses << " }\n";
+      }
+      else
+      {
+        file << "      \"counters\": null\n";
+      }
+      file << "    }";
+    }
+    file << "\n  ]\n}\n";
+
+    magpie::printf ("benchmark results written to %s\n", path);
+    return true;
+  }
+
+private:
+  /// <summary>
+  /// nearest rank percentile of sorted values
+  /// </summary>
+  static double percentile (std::vector <double> const& sorted, double percent)
+  {
+    size_t rank = (size_t)(percent / 100.0 * (double)sorted.size () + 0.5);
+    rank = rank > 0u ? rank - 1u : 0u;
+    return sorted [rank < sorted.size () ? rank : sorted.size () - 1u];
+  }
+
+  static void print (benchmark_result const& result)
+  {
+    magpie::printf ("%-24s", result.name.c_str ());
+    for (benchmark_parameter const& parameter : result.parameters)
+    {
+      magpie::printf (" %s=%.0f", parameter.name, parameter.value);
+    }
+    magpie::printf ("\n  ns/item: p50 %.3f  p90 %.3f  p99 %.3f  (min %.3f, max %.3f)\n",
+      result.p50_ns, result.p90_ns, result.p99_ns, result.min_ns, result.max_ns);
+    if (result.has_counters && result.items > 0.0)
+    {
+      magpie::printf ("  per item: %.2f cycles, %.2f instructions, %.4f cache misses, %.4f branch misses\n",
+        (double)result.counters.cycles / result.items, (double)result.counters.instructions / result.items,
+        (double)result.counters.cache_misses / result.items, (double)result.counters.branch_misses / result.items);
+    }
+  }
+
+  unsigned warmup_repetitions, measured_repetitions;
+  hardware_counters counters;
+  std::vector <benchmark_result> results;
+};
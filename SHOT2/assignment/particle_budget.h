@@ -0,0 +1,210 @@
+// HOW IT WORKS:
+//
+// Lock-free sharing of the particle capacity (PARTICLE_MAX, or SHOT2_MAX_PARTICLES) & the spawn rate between the worker threads.
+//
+// particle_budget is the number of particles that may still be spawned this frame, a single atomic counter.
+// Before emit, the particle system sets it to the frame's spawns, cut down to the room left under the capacity by every slice
+// together, and gives each slice an equal share to reserve. A slice that cannot use all of its share gives the rest back,
+// and slices with room take what was given back a block at a time, so spare room in one slice is used by the others
+// instead of being lost.
+//
+// chunk_free_lists holds the free arena chunks (the particle capacity) as lock-free stacks of chunk indices, one per thread.
+// A thread takes chunks from its own list first & only then from the other threads' lists, like the work stealing scheduler,
+// and a chunk always goes back to the list it started in, so each thread mostly reuses the same memory.
+// Each stack's top is a single 64 bit atomic (index & a change count packed together) updated with compare-and-swap,
+// the change count stops a stale compare-and-swap succeeding after the top was popped & pushed again (the ABA problem).
+
+
+
+#pragma once
+
+#include "magpie.h"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>   // for std::unique_ptr
+#include <vector>
+
+
+/// <summary>
+/// a count of particles shared between threads, reserved a block at a time with compare-and-swap
+/// </summary>
+class alignas (64) particle_budget // own cache line, every thread reserves from it
+{
+public:
+  /// <summary>
+  /// set the number of particles available, called before the threads are started
+  /// </summary>
+  void reset (unsigned count)
+  {
+    remaining.store (count, std::memory_order_relaxed);
+  }
+
+  /// <summary>
+  /// take up to wanted particles
+  /// </summary>
+  /// <returns>the number taken, less than wanted only when the budget has run out</returns>
+  unsigned reserve (unsigned wanted)
+  {
+    unsigned available = remaining.load (std::memory_order_relaxed);
+    for (;;)
+    {
+      unsigned const taken = wanted < available ? wanted : available;
+      if (taken == 0u)
+        return 0u;
+      if (remaining.compare_exchange_weak (available, available - taken, std::memory_order_relaxed))
+        return taken;
+    }
+  }
+
+  /// <summary>
+  /// return particles that were reserved but not used, for other threads to take
+  /// </summary>
+  void give_back (unsigned count)
+  {
+    if (count > 0u)
+    {
+      remaining.fetch_add (count, std::memory_order_relaxed);
+    }
+  }
+
+  unsigned get_remaining () const
+  {
+    return remaining.load (std::memory_order_relaxed);
+  }
+
+private:
+  std::atomic <unsigned> remaining = { 0u };
+};
+
+/// <summary>
+/// free chunk indices (0 <-> { num_chunks - 1 }) in one lock-free stack per owner, see the top of this file
+/// </summary>
+class chunk_free_lists
+{
+public:
+  /// <summary>
+  /// make num_lists empty lists for num_chunks chunks
+  /// </summary>
+  void initialise (unsigned num_chunks, unsigned num_lists)
+  {
+    next.reset (new std::atomic <unsigned> [num_chunks]);
+    home.assign (num_chunks, 0u);
+    lists = std::vector <list_top> (num_lists);
+    this->num_chunks = num_chunks;
+    num_free.store (0u, std::memory_order_relaxed);
+  }
+
+  /// <summary>
+  /// give chunks [first, first + count) to a list, called before the threads are started
+  /// </summary>
+  void add (unsigned list, unsigned first, unsigned count)
+  {
+    MAGPIE_DASSERT (list < lists.size () && first + count <= num_chunks);
+
+    // pushed last to first, so the list hands them out first to last
+    for (unsigned i = first + count; i-- > first;)
+    {
+      home [i] = list;
+      push (i);
+    }
+  }
+
+  /// <summary>
+  /// take a free chunk, from the given list if it has one, otherwise from the next list along that does
+  /// </summary>
+  bool take (unsigned list, unsigned& chunk)
+  {
+    unsigned const num_lists = (unsigned)lists.size ();
+    for (unsigned offset = 0u; offset < num_lists; ++offset)
+    {
+      if (pop ((list + offset) % num_lists, chunk))
+      {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  /// <summary>
+  /// return a chunk to the list it was added to
+  /// </summary>
+  void give_back (unsigned chunk)
+  {
+    MAGPIE_DASSERT (chunk < num_chunks);
+
+    push (chunk);
+  }
+
+  /// <returns>the list a chunk was added to</returns>
+  unsigned home_of (unsigned chunk) const
+  {
+    return home [chunk];
+  }
+
+  /// <returns>number of chunks in every list</returns>
+  unsigned size () const
+  {
+    return num_free.load (std::memory_order_relaxed);
+  }
+
+  void release ()
+  {
+    next.reset ();
+    home.clear ();
+    lists.clear ();
+    num_chunks = 0u;
+    num_free.store (0u, std::memory_order_relaxed);
+  }
+
+private:
+  static unsigned const NO_CHUNK = ~0u;
+
+  struct alignas (64) list_top // own cache line, lists are used by different threads
+  {
+    std::atomic <std::uint64_t> top = { NO_CHUNK };
+  };
+
+  // chunk index in the low 32 bits, count of changes to the top in the high 32 bits
+  static std::uint64_t pack (unsigned chunk, std::uint64_t previous)
+  {
+    return (std::uint64_t)chunk | (((previous >> 32) + 1u) << 32);
+  }
+
+  void push (unsigned chunk)
+  {
+    std::atomic <std::uint64_t>& top = lists [home [chunk]].top;
+    std::uint64_t current = top.load (std::memory_order_relaxed);
+    do
+    {
+      next [chunk].store ((unsigned)current, std::memory_order_relaxed);
+    }
+    while (!top.compare_exchange_weak (current, pack (chunk, current), std::memory_order_release, std::memory_order_relaxed));
+    num_free.fetch_add (1u, std::memory_order_relaxed);
+  }
+
+  bool pop (unsigned list, unsigned& chunk)
+  {
+    std::atomic <std::uint64_t>& top = lists [list].top;
+    std::uint64_t current = top.load (std::memory_order_acquire);
+    for (;;)
+    {
+      unsigned const first = (unsigned)current;
+      if (first == NO_CHUNK)
+        return false;
+      if (top.compare_exchange_weak (current, pack (next [first].load (std::memory_order_relaxed), current),
+        std::memory_order_acquire, std::memory_order_acquire))
+      {
+        num_free.fetch_sub (1u, std::memory_order_relaxed);
+        chunk = first;
+        return true;
+      }
+    }
+  }
+
+  std::unique_ptr <std::atomic <unsigned> []> next; // chunk below each chunk in its list
+  std::vector <unsigned> home;                      // list each chunk belongs to, fixed once added
+  std::vector <list_top> lists;
+  unsigned num_chunks = 0u;
+  std::atomic <unsigned> num_free = { 0u };
+};
@@ -0,0 +1,280 @@
+// HOW IT WORKS:
+//
+// Particle integration kernels.
+// Every kernel performs exactly the same per particle update as the scalar kernel:
+//   position       += velocity * elapsed_seconds
+//   velocity       += delta_velocity (acceleration * elapsed_seconds, the same for every particle of a type)
+//   life_remaining -= elapsed_seconds
+// using the same operations in the same order (no fused multiply-add), so results are bit identical to the scalar kernel.
+//
+// With MAGPIE_SIMD defined (any project with 'simd' in its name) the best kernel the CPU supports is chosen once at startup:
+//   AVX-512 - 16 particles per instruction
+//   AVX2    -  8 particles per instruction
+//   SSE2    -  4 particles per instruction
+//   scalar  -  1 particle at a time, also used for the remainder of each pool
+// Without MAGPIE_SIMD the scalar kernel is always used (and is left to the compiler to vectorise).
+
+
+
+#pragma once
+
+#include "magpie.h"
+
+#if defined (_M_X64) || defined (_M_IX86) || defined (__x86_64__) || defined (__i386__)
+#define PARTICLE_SIMD_X86 1
+#include <immintrin.h>
+#if defined (_MSC_VER)
+#include <intrin.h>   // for __cpuid, __cpuidex
+#endif // _MSC_VER
+#else
+#define PARTICLE_SIMD_X86 0
+#endif // x86
+
+// gcc & clang only emit instructions for the extensions a function is marked with, msvc emits any intrinsic
+// gcc also fuses _mm*_mul_ps + _mm*_add_ps into fma wherever fma is available (avx512f implies it),
+// which would break bit compatibility with the scalar kernel, so contraction is turned off for every kernel
+// (msvc's /fp:precise & clang only contract within a single expression, so never across intrinsics)
+#if defined (__clang__)
+#define PARTICLE_SIMD_TARGET(extensions) __attribute__ ((target (extensions)))
+#define PARTICLE_SIMD_NO_CONTRACT
+#elif defined (__GNUC__)
+#define PARTICLE_SIMD_TARGET(extensions) __attribute__ ((target (extensions), optimize ("fp-contract=off")))
+#define PARTICLE_SIMD_NO_CONTRACT __attribute__ ((optimize ("fp-contract=off")))
+#else
+#define PARTICLE_SIMD_TARGET(extensions)
+#define PARTICLE_SIMD_NO_CONTRACT
+#endif // __clang__ / __GNUC__
+
+
+/// <summary>
+/// signature shared by all integration kernels
+/// </summary>
+typedef void (*particle_integrate_kernel) (float* position_x, float* position_y,
+  float* velocity_x, float* velocity_y, float* life_remaining, unsigned count,
+  float elapsed_seconds, float delta_velocity_x, float delta_velocity_y);
+
+
+/// <summary>
+/// integrate particles [first, count) one at a time
+/// reference implementation, all other kernels must match it bit for bit
+/// </summary>
+PARTICLE_SIMD_NO_CONTRACT
+static void integrate_scalar_range (float* __restrict position_x, float* __restrict position_y,
+  float* __restrict velocity_x, float* __restrict velocity_y, float* __restrict life_remaining,
+  unsigned first, unsigned count,
+  float elapsed_seconds, float delta_velocity_x, float delta_velocity_y)
+{
+  for (unsigned i = first; i < count; ++i)
+  {
+    position_x [i] += velocity_x [i] * elapsed_seconds;
+    position_y [i] += velocity_y [i] * elapsed_seconds;
+
+    velocity_x [i] += delta_velocity_x;
+    velocity_y [i] += delta_velocity_y;
+
+    life_remaining [i] -= elapsed_seconds;
+  }
+}
+
+static void integrate_scalar (float* position_x, float* position_y,
+  float* velocity_x, float* velocity_y, float* life_remaining, unsigned count,
+  float elapsed_seconds, float delta_velocity_x, float delta_velocity_y)
+{
+  integrate_scalar_range (position_x, position_y, velocity_x, velocity_y, life_remaining,
+    0u, count, elapsed_seconds, delta_velocity_x, delta_velocity_y);
+}
+
+
+#if PARTICLE_SIMD_X86
+
+PARTICLE_SIMD_NO_CONTRACT
+static void integrate_sse2 (float* position_x, float* position_y,
+  float* velocity_x, float* velocity_y, float* life_remaining, unsigned count,
+  float elapsed_seconds, float delta_velocity_x, float delta_velocity_y)
+{
+  __m128 const dt = _mm_set1_ps (elapsed_seconds);
+  __m128 const dvx = _mm_set1_ps (delta_velocity_x);
+  __m128 const dvy = _mm_set1_ps (delta_velocity_y);
+
+  unsigned const simd_count = count & ~3u;
+  for (unsigned i = 0u; i < simd_count; i += 4u)
+  {
+    __m128 const vx = _mm_loadu_ps (velocity_x + i);
+    __m128 const vy = _mm_loadu_ps (velocity_y + i);
+
+    _mm_storeu_ps (position_x + i, _mm_add_ps (_mm_loadu_ps (position_x + i), _mm_mul_ps (vx, dt)));
+    _mm_storeu_ps (position_y + i, _mm_add_ps (_mm_loadu_ps (position_y + i), _mm_mul_ps (vy, dt)));
+
+    _mm_storeu_ps (velocity_x + i, _mm_add_ps (vx, dvx));
+    _mm_storeu_ps (velocity_y + i, _mm_add_ps (vy, dvy));
+
+    _mm_storeu_ps (life_remaining + i, _mm_sub_ps (_mm_loadu_ps (life_remaining + i), dt));
+  }
+
+  integrate_scalar_range (position_x, position_y, velocity_x, velocity_y, life_remaining,
+    simd_count, count, elapsed_seconds, delta_velocity_x, delta_velocity_y);
+}
+
+PARTICLE_SIMD_TARGET ("avx2")
+static void integrate_avx2 (float* position_x, float* position_y,
+  float* velocity_x, float* velocity_y, float* life_remaining, unsigned count,
+  float elapsed_seconds, float delta_velocity_x, float delta_velocity_y)
+{
+  __m256 const dt = _mm256_set1_ps (elapsed_seconds);
+  __m256 const dvx = _mm256_set1_ps (delta_velocity_x);
+  __m256 const dvy = _mm256_set1_ps (delta_velocity_y);
+
+  unsigned const simd_count = count & ~7u;
+  for (unsigned i = 0u; i < simd_count; i += 8u)
+  {
+    __m256 const vx = _mm256_loadu_ps (velocity_x + i);
+    __m256 const vy = _mm256_loadu_ps (velocity_y + i);
+
+    _mm256_storeu_ps (position_x + i, _mm256_add_ps (_mm256_loadu_ps (position_x + i), _mm256_mul_ps (vx, dt)));
+    _mm256_storeu_ps (position_y + i, _mm256_add_ps (_mm256_loadu_ps (position_y + i), _mm256_mul_ps (vy, dt)));
+
+    _mm256_storeu_ps (velocity_x + i, _mm256_add_ps (vx, dvx));
+    _mm256_storeu_ps (velocity_y + i, _mm256_add_ps (vy, dvy));
+
+    _mm256_storeu_ps (life_remaining + i, _mm256_sub_ps (_mm256_loadu_ps (life_remaining + i), dt));
+  }
+
+  integrate_scalar_range (position_x, position_y, velocity_x, velocity_y, life_remaining,
+    simd_count, count, elapsed_seconds, delta_velocity_x, delta_velocity_y);
+}
+
+PARTICLE_SIMD_TARGET ("avx512f")
+static void integrate_avx512 (float* position_x, float* position_y,
+  float* velocity_x, float* velocity_y, float* life_remaining, unsigned count,
+  float elapsed_seconds, float delta_velocity_x, float delta_velocity_y)
+{
+  __m512 const dt = _mm512_set1_ps (elapsed_seconds);
+  __m512 const dvx = _mm512_set1_ps (delta_velocity_x);
+  __m512 const dvy = _mm512_set1_ps (delta_velocity_y);
+
+  unsigned const simd_count = count & ~15u;
+  for (unsigned i = 0u; i < simd_count; i += 16u)
+  {
+    __m512 const vx = _mm512_loadu_ps (velocity_x + i);
+    __m512 const vy = _mm512_loadu_ps (velocity_y + i);
+
+    _mm512_storeu_ps (position_x + i, _mm512_add_ps (_mm512_loadu_ps (position_x + i), _mm512_mul_ps (vx, dt)));
+    _mm512_storeu_ps (position_y + i, _mm512_add_ps (_mm512_loadu_ps (position_y + i), _mm512_mul_ps (vy, dt)));
+
+    _mm512_storeu_ps (velocity_x + i, _mm512_add_ps (vx, dvx));
+    _mm512_storeu_ps (velocity_y + i, _mm512_add_ps (vy, dvy));
+
+    _mm512_storeu_ps (life_remaining + i, _mm512_sub_ps (_mm512_loadu_ps (life_remaining + i), dt));
+  }
+
+  integrate_scalar_range (position_x, position_y, velocity_x, velocity_y, life_remaining,
+    simd_count, count, elapsed_seconds, delta_velocity_x, delta_velocity_y);
+}
+
+
+/// <summary>
+/// instruction set extensions supported by both the cpu & the os
+/// </summary>
+struct cpu_features
+{
+  bool sse2 = false;
+  bool avx2 = false;
+  bool avx512f = false;
+};
+
+static void cpuid (int leaf, int subleaf, int registers [4])
+{
+#if defined (_MSC_VER)
+  __cpuidex (registers, leaf, subleaf);
+#else
+  unsigned a, b, c, d;
+  __asm__ __volatile__ ("cpuid" : "=a" (a), "=b" (b), "=c" (c), "=d" (d) : "a" (leaf), "c" (subleaf));
+  registers [0] = (int)a; registers [1] = (int)b; registers [2] = (int)c; registers [3] = (int)d;
+#endif // _MSC_VER
+}
+
+static unsigned long long xgetbv0 ()
+{
+#if defined (_MSC_VER)
+  return _xgetbv (0);
+#else
+  unsigned eax, edx;
+  __asm__ __volatile__ ("xgetbv" : "=a" (eax), "=d" (edx) : "c" (0));
+  return ((unsigned long long)edx << 32) | eax;
+#endif // _MSC_VER
+}
+
+/// <summary>
+/// query cpuid (& xgetbv, to make sure the os saves the wider registers)
+/// </summary>
+static cpu_features detect_cpu_features ()
+{
+  cpu_features features;
+
+  int registers [4] = {};
+  cpuid (0, 0, registers);
+  int const max_leaf = registers [0];
+
+  cpuid (1, 0, registers);
+  features.sse2 = (registers [3] & (1 << 26)) != 0;
+  bool const osxsave = (registers [2] & (1 << 27)) != 0;
+  bool const avx = (registers [2] & (1 << 28)) != 0;
+
+  if (!osxsave || !avx || max_leaf < 7)
+  {
+    return features;
+  }
+
+  unsigned long long const xcr0 = xgetbv0 ();
+  bool const os_ymm = (xcr0 & 0x06u) == 0x06u; // xmm & ymm state
+  bool const os_zmm = (xcr0 & 0xe6u) == 0xe6u; // xmm, ymm, opmask & zmm state
+
+  cpuid (7, 0, registers);
+  features.avx2 = os_ymm && (registers [1] & (1 << 5)) != 0;
+  features.avx512f = os_zmm && (registers [1] & (1 << 16)) != 0;
+
+  return features;
+}
+
+#endif // PARTICLE_SIMD_X86
+
+
+/// <summary>
+/// name of a kernel, for printing
+/// </summary>
+static char const* particle_integrate_kernel_name (particle_integrate_kernel kernel)
+{
+#if PARTICLE_SIMD_X86
+  if (kernel == integrate_avx512) return "avx512";
+  if (kernel == integrate_avx2) return "avx2";
+  if (kernel == integrate_sse2) return "sse2";
+#endif // PARTICLE_SIMD_X86
+  return kernel == integrate_scalar ? "scalar" : "unknown";
+}
+
+/// <summary>
+/// widest kernel supported by this cpu, only called with MAGPIE_SIMD (inline, so builds without it do not warn it is unused)
+/// </summary>
+inline particle_integrate_kernel select_particle_integrate_kernel ()
+{
+#if PARTICLE_SIMD_X86
+  cpu_features const features = detect_cpu_features ();
+  if (features.avx512f) return integrate_avx512;
+  if (features.avx2) return integrate_avx2;
+  if (features.sse2) return integrate_sse2;
+#endif // PARTICLE_SIMD_X86
+  return integrate_scalar;
+}
+
+/// <summary>
+/// kernel used by process, chosen once on first use (particle_system_t::initialise)
+/// </summary>
+static particle_integrate_kernel particle_integrate ()
+{
+#ifdef MAGPIE_SIMD
+  static particle_integrate_kernel const kernel = select_particle_integrate_kernel ();
+  return kernel;
+#else
+  return integrate_scalar;
+#endif // MAGPIE_SIMD
+}
@@ -1,9 +1,9 @@
 // HOW IT WORKS:
 //
 // Simple CPU particle simulation.
-// Particle are emitted from 3 locations,
+// Particles are emitted by a number of particle types (3 by default, or loaded from a file, see particle_types.h),
 // with differing position offsets, velocities, accelerations and start & end colours.
-// Particle types are split evenly between all 3 types.
+// Each frame's spawns are split between the types by each type's share.
 // Each particle is represented by a single pixel.
 //
 // Each particle's position is controlled by:
@@ -15,9 +15,42 @@
 //   life_time      | maximum amount of time the particle can live for    | per particle      | random within a range
 //   life_remaining | initially set to life_time, countdown to 0          | per particle      | random within a range
 //   kill_y         | the minimum position.y value before being destroyed | per particle type | fixed
+// Only 1 / life_time (inv_life_time) is stored, as it is only ever used to find the life ratio.
 //
 // Each particle's colour is determined by the ratio between life_remaining and life_time.
-// The start and end colours are fixed and are the same for each particle type.
+// The start and end colours are fixed and are the same for each particle of a type,
+// so each type has a table of RGBA8 colours for 256 evenly spaced life ratios, built once,
+// and a vertex's colour is a single table look up rather than 4 lerps, a divide & 4 float -> byte conversions.
+//
+// Each frame, emit decides how many new particles each chunk gets, then update_chunk makes a single pass over each chunk
+// on the worker threads: integrating, removing expired particles, spawning into their slots & writing every vertex,
+// so each particle's memory is streamed through once per frame rather than once each by process, emit & render.
+//
+// Motion is constant acceleration, so a particle's position at any age has a closed form:
+//   position = spawn position + spawn velocity * age + acceleration * age^2 / 2
+// In analytic mode (SHOT2_ANALYTIC, see config.h) particles keep only their spawn state & spawn time,
+// and update_chunk_analytic evaluates each particle's position & colour at the current time as it writes the vertex.
+// A particle's death is known when it spawns (the sooner of life_time running out & falling below kill_y),
+// so nothing is written back for particles that survive: the update only reads particle state.
+// Each chunk is also kept in order of death time, so its expired particles are always at the front:
+// expiry just moves the chunk's first live particle on, costing only as much as the number of particles that die,
+// without checking every live particle or swapping the last particle into the gaps.
+// New particles are only spawned into the last chunk of each type (merged into death order there),
+// so the chunks stay in spawn order, and a chunk goes back to the free list when its last particle dies.
+// Analytic motion is exact, so particles follow slightly different paths than the per frame (stepped) integration.
+//
+// In pipelined mode (SHOT2_PIPELINED, see config.h) update only runs emit & then dispatches the fused pass to the workers,
+// returning straight away, so the main thread draws & presents while the workers simulate. There are two vertex arrays:
+// the workers write the next frame into one while the last finished frame is drawn from the other.
+// The next update is the single sync point: it waits for the pass in flight & swaps the arrays,
+// so each frame draws the vertices of the update before, one frame behind the simulation.
+// The main thread's own share of chunks is taken by the workers' work stealing while it draws.
+// Only the vertices are double buffered: the particles themselves are only touched by the pass in flight.
+//
+// With SHOT2_CULL (see vertex_cull.h) the pass writes its vertices into a scratch array instead,
+// and only the vertices that would change the picture are compacted into the renderer's vertex array, in draw order.
+// With SHOT2_RENDERER=software (see software_renderer.h) the scratch array is drawn into a framebuffer on the workers instead,
+// straight after the pass (at the sync point when pipelined), and render uploads the framebuffer rather than a point list.
 
 
 
@@ -25,31 +58,35 @@
 
 #include "constants.h"
 #include "extra/particle_renderer_2d.h"
+#include "config.h"
+#include "fast_random.h"
+#include "particle_budget.h"
+#include "particle_simd.h"
+#include "particle_types.h"
+#include "profiler.h"
+#include "software_renderer.h"
+#include "thread_placement.h"
+#include "thread_pool.h"
+#include "timer.h"
+#include "vertex_cull.h"
+#include "virtual_memory.h"
+#include "work_stealing.h"
 
 #include "magpie.h"
 
-#include <random>   // for std::random_device, std::uniform_real_distribution, std::uniform_int_distribution
-#include <thread>
 #include <algorithm>
-
-int const numThreads = 8;
+#include <atomic>
+#include <climits>  // for UINT_MAX
+#include <cmath>    // for std::sqrt, std::fmod
+#include <cstdint>  // for std::uint64_t
+#include <limits>   // for std::numeric_limits
+#include <memory>   // for std::unique_ptr
+#include <new>      // for std::align_val_t
+#include <string>   // for std::to_string
+#include <vector>
 
 // UTILITY
-
-struct vector4
-{
-    float x;
-    float y;
-};
-
-struct colourf
-{
-  float r;
-  float g;
-  float b;
-  float a;
-};
-
+// (inline, as only the benchmarks call these now, see benchmark.h)
 
 /// <summary>
 /// returns a random number between min and max inclusive
@@ -57,14 +94,12 @@ struct colourf
 /// <param name="min">minimum random number (inclusive)</param>
 /// <param name="max">maximum random number (inclusive)</param>
 /// <returns>random number between min & max (inclusive)</returns>
-static float random_getd (float min, float max)
+inline float random_getd (float min, float max)
 {
   MAGPIE_DASSERT (max >= min);
 
-  static std::random_device rd;
-  std::uniform_real_distribution <float> distribution (min, max);
-
-  return distribution (rd);
+  // each thread has its own generator, see fast_random.h
+  return thread_random_engine ().uniform (min, max);
 }
 
 /// <summary>
@@ -73,394 +108,1981 @@ static float random_getd (float min, float max)
 /// <param name="min">minimum random number (inclusive)</param>
 /// <param name="max">maximum random number (inclusive)</param>
 /// <returns>random number between min & max (inclusive)</returns>
-static long long random_geti (long long min, long long max)
+inline long long random_geti (long long min, long long max)
 {
   MAGPIE_DASSERT (max >= min);
 
-  static std::random_device rd;
-  std::uniform_int_distribution <i64> distribution (min, max);
-
-  return distribution (rd);
+  // each thread has its own generator, see fast_random.h
+  return thread_random_engine ().uniform (min, max);
 }
 
+
+// PARTICLES
+
 /// <summary>
-/// linearly interpolate value between v0 and v1 based on the 0.0 - 1.0 value of t
+/// fixed capacity structure-of-arrays storage for particles of a single type
+/// each per particle value lives in its own contiguous array,
+/// so process & render stream through memory linearly rather than chasing pointers
+/// (7 floats = 28 bytes per particle, type constants are held by the type's particle_type_desc)
+/// the arrays belong to a particle_arena, a pool only points into them, so pools are cheap to move around
 /// </summary>
-/// <param name="v0">start value</param>
-/// <param name="v1">end value</param>
-/// <param name="t">lerp proportion</param>
-/// <returns>interpolated value</returns>
-static float lerp (float v0, float v1, float t)
+struct particle_pool
 {
-  return ((1.0f - t) * v0) + (t * v1);
-}
+  static unsigned const NUM_ARRAYS = 7u;
 
+  /// <summary>
+  /// point the pool at storage for max_particles, the pool starts empty
+  /// </summary>
+  /// <param name="storage">NUM_ARRAYS * max_particles floats</param>
+  /// <param name="max_particles">maximum number of particles the pool can hold</param>
+  void attach (float* storage, unsigned max_particles)
+  {
+    capacity = max_particles;
+    count = 0u;
+
+    position_x = storage;
+    position_y = position_x + capacity;
+    velocity_x = position_y + capacity;
+    velocity_y = velocity_x + capacity;
+    inv_life_time = velocity_y + capacity;
+    life_remaining = inv_life_time + capacity;
+    spawn_time = life_remaining + capacity;
+  }
 
-// PARTICLES
+  bool full () const
+  {
+    return count == capacity;
+  }
+
+  /// <summary>
+  /// number of particles still alive, [first, count)
+  /// </summary>
+  unsigned num_live () const
+  {
+    return count - first;
+  }
 
-class particle
-{
-public:
   /// <summary>
-  /// update particle's position, lifetime & colour
+  /// add a particle to the end of the pool
   /// </summary>
-  /// <param name="elapsed_seconds">elapsed time since last frame</param>
-  /// <returns>true, if particle has expired and needs deleting</returns>
-  virtual bool process (float elapsed_seconds) = 0;
+  /// <returns>index of the new particle, caller fills in its values</returns>
+  unsigned spawn ()
+  {
+    MAGPIE_DASSERT (count < capacity);
+
+    return count++;
+  }
 
-  float  life_time = {};
-  float  life_remaining = {};
-  float  kill_y = {};
+  /// <summary>
+  /// remove a particle by moving the last particle into its slot
+  /// </summary>
+  /// <param name="index">index of the particle to remove</param>
+  void kill (unsigned index)
+  {
+    MAGPIE_DASSERT (index < count);
+
+    unsigned const last = --count;
+    position_x [index] = position_x [last];
+    position_y [index] = position_y [last];
+    velocity_x [index] = velocity_x [last];
+    velocity_y [index] = velocity_y [last];
+    inv_life_time [index] = inv_life_time [last];
+    life_remaining [index] = life_remaining [last];
+    spawn_time [index] = spawn_time [last];
+  }
 
-  vector4 position = {};
-  vector4 velocity = {};
-  vector4 acceleration = {};
+  /// <summary>
+  /// copy another pool's particles into this pool's storage
+  /// </summary>
+  void copy_from (particle_pool const& other)
+  {
+    MAGPIE_DASSERT (other.count <= capacity);
+
+    count = other.count;
+    first = other.first;
+    std::copy_n (other.position_x, count, position_x);
+    std::copy_n (other.position_y, count, position_y);
+    std::copy_n (other.velocity_x, count, velocity_x);
+    std::copy_n (other.velocity_y, count, velocity_y);
+    std::copy_n (other.inv_life_time, count, inv_life_time);
+    std::copy_n (other.life_remaining, count, life_remaining);
+    std::copy_n (other.spawn_time, count, spawn_time);
+  }
 
-  colourf colour = {};
-  colourf start_colour = {};
-  colourf end_colour = {};
+  float* position_x = nullptr;
+  float* position_y = nullptr;
+  float* velocity_x = nullptr;
+  float* velocity_y = nullptr;
+  float* inv_life_time = nullptr; // 1 / life_time
+  float* life_remaining = nullptr;
+  float* spawn_time = nullptr;    // analytic mode only, see update_chunk_analytic
+
+  unsigned count = 0u, capacity = 0u;
+  unsigned chunk_index = ~0u; // the arena chunk the pool's storage is, ~0u for storage from anywhere else
+  unsigned first = 0u; // particles before first have expired, death ordered chunks only (see update_chunk_analytic)
+
+  // set by emit, the number of particles update_chunk spawns into this chunk this frame & the chunk's own random stream
+  // (its own stream, so the spawned values do not depend on which thread updates the chunk)
+  unsigned spawn_quota = 0u;
+  random_engine random;
 };
 
-class particle_a : public particle
+/// <summary>
+/// storage for a fixed number of equally sized particle chunks, reserved as one block of address space up front
+/// free chunks are handed out & returned through lock-free lists, one per slice (see chunk_free_lists in particle_budget.h),
+/// so a slice can use another slice's spare chunks, the arena itself never allocates again
+/// a chunk is only backed by memory the first time it is taken (see virtual_memory.h), so memory grows with the particles in use
+/// without moving any chunk, & is written then by the taking thread, so its pages go on that thread's node (see thread_placement.h)
+/// </summary>
+class particle_arena
 {
 public:
-  particle_a ()
+  particle_arena () = default;
+  particle_arena (particle_arena const&) = delete;
+  particle_arena& operator= (particle_arena const&) = delete;
+  ~particle_arena ()
   {
-    // left hand side of screen
+    release ();
+  }
 
-    life_time = life_remaining = random_getd (7.5f, 13.0f);
-    kill_y = -(float)SCREEN_HEIGHT / 2.0f;
+  /// <summary>
+  /// allocate storage for every chunk
+  /// </summary>
+  /// <param name="chunk_capacity">number of particles in each chunk, rounded up to keep every array cache line aligned</param>
+  /// <param name="num_chunks">number of chunks</param>
+  /// <param name="num_lists">number of free lists, chunks are only free once added to one with add_free_chunks</param>
+  /// <param name="huge_pages">back the storage with huge pages where the OS allows it</param>
+  bool initialise (unsigned chunk_capacity, unsigned num_chunks, unsigned num_lists = 1u, bool huge_pages = false)
+  {
+    MAGPIE_DASSERT (storage == nullptr);
 
-    position = { -(float)SCREEN_WIDTH / 2.0f + random_getd (0.0f, 200.0f),
-      -(float)SCREEN_HEIGHT / 2.0f + random_getd (0.0f, 100.0f)};
-    velocity = { random_getd (magpie::maths::cos (magpie::maths::radians (89.0f)), magpie::maths::cos (magpie::maths::radians (75.0f))) * 200.f,
-      random_getd (magpie::maths::sin (magpie::maths::radians (75.0f)), magpie::maths::sin (magpie::maths::radians (89.0f))) * 200.f
-      };
-    acceleration = { 2.0f, -26.5f};
+    this->chunk_capacity = (chunk_capacity + FLOATS_PER_LINE - 1u) & ~(FLOATS_PER_LINE - 1u);
+    this->num_chunks = num_chunks;
+    free_lists.initialise (num_chunks, num_lists);
+    committed.assign (num_chunks, 0u);
+    num_committed.store (0u, std::memory_order_relaxed);
 
-    start_colour = { 1.0f, 0.2f, 0.2f, 1.0f }; // red
-    end_colour = { 0.2f, 1.0f, 1.0f, 1.0f }; // inverse red
+    storage = (float*)memory.reserve (get_size_bytes (), huge_pages);
+    return storage != nullptr;
   }
 
-  bool process (float elapsed_seconds) override
+  /// <summary>
+  /// an empty pool using a chunk's storage
+  /// </summary>
+  /// <param name="index">chunk index, 0 <-> { get_num_chunks () - 1 }</param>
+  particle_pool chunk (unsigned index) const
   {
-    // update linear motion
-    position.x += velocity.x * elapsed_seconds;
-    position.y += velocity.y * elapsed_seconds;
+    MAGPIE_DASSERT (index < num_chunks);
 
-    velocity.x += acceleration.x * elapsed_seconds;
-    velocity.y += acceleration.y * elapsed_seconds;
+    particle_pool pool;
+    pool.attach (storage + (size_t)index * chunk_capacity * particle_pool::NUM_ARRAYS, chunk_capacity);
+    pool.chunk_index = index;
+    return pool;
+  }
 
-    // update colour
-    colour.r = lerp (end_colour.r, start_colour.r, life_remaining / life_time);
-    colour.g = lerp (end_colour.g, start_colour.g, life_remaining / life_time);
-    colour.b = lerp (end_colour.b, start_colour.b, life_remaining / life_time);
-    colour.a = lerp (end_colour.a, start_colour.a, life_remaining / life_time);
+  /// <summary>
+  /// back every chunk with memory now, for code that uses chunk () directly rather than take_chunk (e.g. the benchmarks)
+  /// </summary>
+  /// <returns>false, if there was not enough memory</returns>
+  bool commit_all ()
+  {
+    for (unsigned index = 0u; index < num_chunks; ++index)
+    {
+      if (!committed [index] && !commit_chunk (index))
+      {
+        return false;
+      }
+    }
+    return true;
+  }
 
-    // update life remaining
-    life_remaining -= elapsed_seconds;
+  /// <summary>
+  /// make chunks [first, first + count) free, in a free list, called before the threads are started
+  /// </summary>
+  void add_free_chunks (unsigned list, unsigned first, unsigned count)
+  {
+    free_lists.add (list, first, count);
+  }
 
-    // is particle still alive?
-    if (life_remaining <= 0.0f)
-      return true;
-    else if (position.y < kill_y)
-      return true;
-    else
+  /// <summary>
+  /// take a free chunk, from the given free list if it has one, otherwise from any other list, safe from any thread
+  /// </summary>
+  /// <returns>true, if there was a free chunk</returns>
+  bool take_chunk (unsigned list, particle_pool& pool)
+  {
+    unsigned index = 0u;
+    if (!free_lists.take (list, index))
+    {
+      return false;
+    }
+    if (!committed [index] && !commit_chunk (index))
+    {
+      free_lists.give_back (index);
       return false;
+    }
+    pool = chunk (index);
+    return true;
   }
-};
 
-class particle_b : public particle
-{
-public:
-  particle_b ()
+  /// <summary>
+  /// return a chunk taken with take_chunk to its free list, safe from any thread
+  /// </summary>
+  void give_back_chunk (particle_pool const& pool)
   {
-    // middle of screen
-
-    life_time = life_remaining = random_getd (9.0f, 10.0f);
-    kill_y = -(float)SCREEN_HEIGHT / 2.0f + 50.0f;
+    MAGPIE_DASSERT (pool.chunk_index < num_chunks);
 
-    position = { random_getd (0.0f, (float)SCREEN_WIDTH / 3.0f),
-      (float)SCREEN_HEIGHT / 2.0f};
-    velocity = { -50.0f,
-      random_getd (-100.0f, -60.0f)};
-    acceleration = { 0.0f, 0.0f};
-
-    start_colour = { 0.2f, 1.0f, 0.2f, 1.0f }; // green
-    end_colour = { 1.0f, 0.2f, 1.0f, 1.0f }; // inverse green
+    free_lists.give_back (pool.chunk_index);
   }
 
-  bool process (float elapsed_seconds) override
+  /// <returns>the free list a chunk belongs to, the slice whose thread touched it</returns>
+  unsigned get_home_list (unsigned index) const
   {
-    // update linear motion
-    position.x += velocity.x * elapsed_seconds;
-    position.y += velocity.y * elapsed_seconds;
-
-    velocity.x += acceleration.x * elapsed_seconds;
-    velocity.y += acceleration.y * elapsed_seconds;
-
-    // update colour
-    colour.r = lerp (end_colour.r, start_colour.r, life_remaining / life_time);
-    colour.g = lerp (end_colour.g, start_colour.g, life_remaining / life_time);
-    colour.b = lerp (end_colour.b, start_colour.b, life_remaining / life_time);
-    colour.a = lerp (end_colour.a, start_colour.a, life_remaining / life_time);
-
-    // update life remaining
-    life_remaining -= elapsed_seconds;
-
-    // is particle still alive?
-    if (position.y < kill_y)
-      return true;
-    else if (life_remaining <= 0.0f)
-      return true;
-    else
-      return false;
+    return free_lists.home_of (index);
   }
-};
 
-class particle_c : public particle
-{
-public:
-  particle_c ()
+  unsigned get_num_free_chunks () const
   {
-    // right hand side of screen
+    return free_lists.size ();
+  }
 
-    life_time = life_remaining = random_getd (3.5f, 6.0f);
-    kill_y = -(float)SCREEN_HEIGHT / 2.0f + 15.0f;
+  unsigned get_num_chunks () const
+  {
+    return num_chunks;
+  }
 
-    position = { (float)SCREEN_WIDTH / 2.0f - 300.0f,
-      -(float)SCREEN_HEIGHT / 2.0f + 400.0f};
-    velocity = { random_getd (-50.0f, 50.0f),
-      random_getd (-50.0f, 50.0f)};
-    acceleration = { 0.0f, 0.0f};
+  /// <returns>size of the arena's storage in bytes, all reserved but only committed as chunks are first taken</returns>
+  size_t get_size_bytes () const
+  {
+    return get_chunk_bytes () * num_chunks;
+  }
 
-    start_colour = { 0.2f, 0.2f, 1.0f, 1.0f }; // blue
-    end_colour = { 1.0f, 1.0f, 0.2f, 1.0f }; // inverse blue
+  /// <returns>bytes of the arena's storage backed by memory</returns>
+  size_t get_committed_bytes () const
+  {
+    return get_chunk_bytes () * num_committed.load (std::memory_order_relaxed);
   }
 
-  bool process (float elapsed_seconds) override
+  /// <returns>true, if the storage is backed by huge pages</returns>
+  bool has_huge_pages () const
   {
-    // update linear motion
-    position.x += velocity.x * elapsed_seconds;
-    position.y += velocity.y * elapsed_seconds;
+    return memory.get_huge_pages ();
+  }
 
-    velocity.x += acceleration.x * elapsed_seconds;
-    velocity.y += acceleration.y * elapsed_seconds;
+  void release ()
+  {
+    memory.release ();
+    storage = nullptr;
+    free_lists.release ();
+    committed.clear ();
+    chunk_capacity = num_chunks = 0u;
+  }
 
-    // update colour
-    colour.r = lerp (end_colour.r, start_colour.r, life_remaining / life_time);
-    colour.g = lerp (end_colour.g, start_colour.g, life_remaining / life_time);
-    colour.b = lerp (end_colour.b, start_colour.b, life_remaining / life_time);
-    colour.a = lerp (end_colour.a, start_colour.a, life_remaining / life_time);
+private:
+  static size_t const CACHE_LINE_SIZE = 64u;
+  static unsigned const FLOATS_PER_LINE = (unsigned)(CACHE_LINE_SIZE / sizeof (float));
 
-    // update life remaining
-    life_remaining -= elapsed_seconds;
+  size_t get_chunk_bytes () const
+  {
+    return (size_t)chunk_capacity * particle_pool::NUM_ARRAYS * sizeof (float);
+  }
 
-    // is particle still alive?
-    if (life_remaining <= 0.0f)
-      return true;
-    else if (position.y < kill_y)
-      return true;
-    else
+  /// <summary>
+  /// back a chunk with memory & write it once, on the thread taking it for the first time
+  /// only the thread that took the chunk from a free list touches its flag, later takers see it through the list
+  /// </summary>
+  bool commit_chunk (unsigned index)
+  {
+    size_t const offset = get_chunk_bytes () * index;
+    if (!memory.commit (offset, get_chunk_bytes ()))
+    {
       return false;
+    }
+    std::fill_n (storage + offset / sizeof (float), get_chunk_bytes () / sizeof (float), 0.0f);
+    committed [index] = 1u;
+    num_committed.fetch_add (1u, std::memory_order_relaxed);
+    return true;
   }
+
+  virtual_memory memory;
+  float* storage = nullptr;
+  unsigned chunk_capacity = 0u, num_chunks = 0u;
+  chunk_free_lists free_lists;
+  std::vector <unsigned char> committed; // per chunk, 1 once backed by memory
+  std::atomic <unsigned> num_committed = { 0u };
 };
 
+// PARTICLE SPAWNING
+//
+// Spawn values are drawn from the random_engine passed in, so a slice's particles depend only on its own random stream.
+// Particles spawned together at the end of a chunk are initialised a whole array at a time from a random_batch_engine
+// seeded from the chunk's stream, so the spawn values are filled 4 at a time with SSE2 (see fast_random.h).
 
-// PARTICLE SYSTEM
+/// <summary>
+/// a single spawn value, fixed values use up no random numbers
+/// </summary>
+static float spawn_value (random_engine& random, float min, float max)
+{
+  return min == max ? min : random.uniform (min, max);
+}
 
 /// <summary>
-/// update all active particles
-/// remove expired particles
+/// an array of spawn values, fixed values use up no random numbers
 /// </summary>
-/// <param name="particles">list of particle pointers</param>
-/// <param name="elapsed_seconds">elapsed frame time</param>
-/// <returns>updated list of pointers to particles</returns>
-void process(std::vector <particle*>& particles, float elapsed_seconds)
+static void spawn_values (random_batch_engine& random, float* values, unsigned count, float min, float max)
 {
-  // iterators provide a generic way to access the data at a particular element of a container
-  // e.g. vectors, lists and maps // https://en.cppreference.com/w/cpp/container
-  // iterators are 'special' in that they can be incremented to go to the next element in the collection
-  // (even if it is not physically next to it in memory // https://en.cppreference.com/w/cpp/iterator)
-  std::vector <particle*>::iterator it = particles.begin ();
-  while (it != particles.end ())
+  if (min == max)
   {
-    // get pointer to particle from iterator
-    particle* p = *it;
-    MAGPIE_DASSERT (p);
-
-    // update particle, returns true of needs deleting
-    if (p->process (elapsed_seconds))
-    {
-      // particle needs deleting
-
-      // release data previously allocated for this particle
-      // no effect if p == nullptr
-      delete p;
-
-      // remove pointer to now released particle from list
-      // std::list::erase () returns next valid element :)
-      std::swap(*it, particles.back());
-      particles.pop_back();
-    }
-    else
-    {
-      // increment iterator here if this particle was not removed
-      it++;
-    }
+    std::fill_n (values, count, min);
+  }
+  else
+  {
+    random.fill (values, count, min, max);
   }
 }
+
 /// <summary>
-/// create/add new particles to the list
+/// give the particle in slot i new spawn values
 /// </summary>
-/// <param name="particles">list of particle pointers</param>
-/// <param name="elapsed_seconds">elapsed frame time</param>
-/// <returns>updated list of pointers to particles</returns>
-void emit (std::vector <particle*>& particles, float elapsed_seconds)
+static void initialise_particle (particle_pool& pool, unsigned i, random_engine& random, particle_spawn_ranges const& ranges)
 {
-  long long num_particles_spawned = 0u;
-  int particle_type = 0;
-  for (float i = 0.f; i < (float)PARTICLE_MAX * 2.f; i += 1.f)
-  {
-    // make sure we never exceed maximum particle budget
-    if (particles.size () == PARTICLE_MAX/numThreads)
-    {
-      magpie::printf ("num particles == PARTICLE_MAX\n");
-      continue;
-    }
-    // make sure we never exceed frame's particle budget
-    if (num_particles_spawned == PARTICLE_SPAWN_RATE/numThreads)
-    {
-      continue;
-    }
-    // keep track of how many particles have been emitted this frame
-    num_particles_spawned++;
+  pool.life_remaining [i] = spawn_value (random, ranges.life_min, ranges.life_max);
+  pool.inv_life_time [i] = 1.0f / pool.life_remaining [i];
 
-    // add particle
-    // evenly spread particles between each type
-    if (particle_type == 0)
-    {
-      particles.push_back (new particle_a);
-      magpie::printf ("spawn particle a\n");
-    }
-    else if (particle_type == 1)
-    {
-      particles.push_back (new particle_b);
-    }
-    else // particle_type == 2
-    {
-      particles.push_back (new particle_c);
-    }
-    // create the next type of particle on the next iteration
-    particle_type++;
-    // 'wrap' particle type so its always valid, 0 <-> { NUM_PARTICLE_TYPES - 1 }
-    particle_type = particle_type % NUM_PARTICLE_TYPES;
-  }
+  pool.position_x [i] = spawn_value (random, ranges.position_x_min, ranges.position_x_max);
+  pool.position_y [i] = spawn_value (random, ranges.position_y_min, ranges.position_y_max);
+  pool.velocity_x [i] = spawn_value (random, ranges.velocity_x_min, ranges.velocity_x_max);
+  pool.velocity_y [i] = spawn_value (random, ranges.velocity_y_min, ranges.velocity_y_max);
 }
 
-void worker(std::vector <particle*>& particles, float elapsed_seconds)
+/// <summary>
+/// give particles [first, first + count) new spawn values, an array at a time
+/// </summary>
+static void initialise_particles (particle_pool& pool, unsigned first, unsigned count, random_batch_engine& random,
+  particle_spawn_ranges const& ranges)
 {
+  spawn_values (random, pool.life_remaining + first, count, ranges.life_min, ranges.life_max);
+  for (unsigned i = first; i < first + count; ++i)
+  {
+    pool.inv_life_time [i] = 1.0f / pool.life_remaining [i];
+  }
 
-    //pass reference
-    process(particles, elapsed_seconds);
-    emit(particles, elapsed_seconds);
+  spawn_values (random, pool.position_x + first, count, ranges.position_x_min, ranges.position_x_max);
+  spawn_values (random, pool.position_y + first, count, ranges.position_y_min, ranges.position_y_max);
+  spawn_values (random, pool.velocity_x + first, count, ranges.velocity_x_min, ranges.velocity_x_max);
+  spawn_values (random, pool.velocity_y + first, count, ranges.velocity_y_min, ranges.velocity_y_max);
 }
 
-class particle_system_t
+
+// PARTICLE SYSTEM
+
+/// <summary>
+/// number of particles in a chunk, the unit of work handed to (and stolen between) worker threads
+/// </summary>
+static unsigned const PARTICLE_CHUNK_SIZE = 1u << 14;
+
+/// <summary>
+/// number of particles a slice reserves at a time from a shared budget, once it has used its own share, see particle_budget.h
+/// </summary>
+static unsigned const PARTICLE_BUDGET_BLOCK = 1u << 10;
+
+/// <summary>
+/// all particles owned by a single worker thread, grouped by type into fixed size chunks
+/// the owning thread emits into its slice, but any thread may process any chunk
+/// </summary>
+struct particle_slice
 {
-public:
-  bool initialise (magpie::renderer& renderer)
+  unsigned max_particles = 0u; // this slice's share of the capacity, the slice's limit with a fixed budget
+  unsigned spawn_rate = 0u;    // this slice's share of the particles spawned every frame
+  unsigned budget_share = 0u;  // with a shared budget, this slice's share of the frame's spawns, see particle_budget
+  unsigned num_spawned = 0u;   // particles planned by the last emit
+  float spawn_per_second = 0.0f; // this slice's share of the emitter's rate, used instead of spawn_rate when > 0
+  float spawn_carry = 0.0f;    // fraction of a particle left over from the last frame, with spawn_per_second
+  random_engine random;        // this slice's own random stream, used by emit
+  bool death_ordered = false;  // chunks are kept in death order (analytic mode), see update_chunk_analytic
+
+  /// <summary>
+  /// chunks needed to hold max_particles
+  /// emit only takes a new chunk when every chunk of that type is full, so each type has at most one chunk that is not full
+  /// death ordered chunks are never compacted, they drain from the front & are only freed once their last particle dies,
+  /// so on average they are only ~80% full (the shortest lives over the longest), they get half as many again
+  /// </summary>
+  static unsigned chunks_needed (unsigned max_particles, unsigned num_types, bool death_ordered = false)
   {
-    //Resizes the variable containing the maximum number of particles (verticies) 
-    return particle_renderer.initialise (PARTICLE_MAX);
+    unsigned const capacity = death_ordered ? max_particles + max_particles / 2u : max_particles;
+    return (capacity + PARTICLE_CHUNK_SIZE - 1u) / PARTICLE_CHUNK_SIZE + num_types;
+  }
+
+  /// <summary>
+  /// put chunks [first_chunk, first_chunk + num_chunks) of the arena in this slice's free list, with a list of chunks per type
+  /// every type's list is sized for all of the arena's chunks, as the slice may use other slices' spare chunks,
+  /// so moving chunks between them never allocates
+  /// </summary>
+  /// <param name="free_list">the arena free list this slice takes chunks from first</param>
+  void initialise (particle_arena& arena, unsigned free_list, unsigned first_chunk, unsigned num_chunks, unsigned num_types)
+  {
+    this->arena = &arena;
+    this->free_list = free_list;
+    arena.add_free_chunks (free_list, first_chunk, num_chunks);
+    chunks.resize (num_types);
+    for (std::vector <particle_pool>& type_chunks : chunks)
+    {
+      type_chunks.clear ();
+      type_chunks.reserve (arena.get_num_chunks ());
+    }
+    heap_allocations = 0u;
+  }
 
+  /// <summary>
+  /// number of particles the emitter asks for this frame, before the limits on the slice
+  /// </summary>
+  unsigned frame_spawns (float elapsed_seconds)
+  {
+    if (spawn_per_second <= 0.0f)
+    {
+      return spawn_rate;
+    }
 
+    float const spawns = spawn_per_second * elapsed_seconds + spawn_carry;
+    unsigned const whole = spawns < (float)UINT_MAX ? (unsigned)spawns : UINT_MAX;
+    spawn_carry = spawns - (float)whole;
+    return whole;
   }
-  //reserving room for particles
-  particle_system_t() {
-      for (int i = 0; i < numThreads; ++i) {
-          particles->reserve(PARTICLE_MAX/numThreads);
-      }
+
+  unsigned count () const
+  {
+    unsigned total = 0u;
+    for (std::vector <particle_pool> const& type_chunks : chunks)
+      for (particle_pool const& chunk : type_chunks)
+        total += chunk.num_live ();
+    return total;
   }
 
-  void update (float elapsed_seconds, long long& num_active_particles)
+  /// <summary>
+  /// share num_spawns particles of a type between the type's chunks, as spawn quotas for update_chunk
+  /// chunks with room are used first, a free chunk is only taken once every chunk of the type has no room left
+  /// so each type has at most one chunk that is not full (including its quota)
+  /// death ordered chunks only spawn into the last chunk, so the chunks stay in spawn order,
+  /// & stop short rather than leave the arena when there are no free chunks left
+  /// </summary>
+  /// <param name="type">index of the particle type to spawn</param>
+  /// <param name="num_spawns">number of particles to spawn</param>
+  /// <returns>number of particles planned</returns>
+  unsigned plan_spawns (unsigned type, unsigned num_spawns)
   {
-      std::vector <std::thread> threads;
-      for (int i = 0; i < numThreads; ++i) {
-          threads.emplace_back(worker,std::ref (particles[i]), elapsed_seconds);
-          
-      }
-      for (std::thread& t : threads)
+    std::vector <particle_pool>& type_chunks = chunks [type];
+    unsigned num_planned = 0u;
+    size_t i = death_ordered && !type_chunks.empty () ? type_chunks.size () - 1u : 0u;
+    for (; num_spawns > 0u; ++i)
+    {
+      if (i == type_chunks.size ())
       {
-          // pause this thread until other thread exits
-          t.join();
+        if (!take_free_chunk (type, !death_ordered))
+        {
+          break;
+        }
       }
 
+      particle_pool& chunk = type_chunks [i];
+      unsigned const room = chunk.capacity - chunk.num_live () - chunk.spawn_quota;
+      unsigned const quota = num_spawns < room ? num_spawns : room;
+      if (quota > 0u)
+      {
+        chunk.spawn_quota += quota;
+        chunk.random.seed (random.next64 ());
+        num_spawns -= quota;
+        num_planned += quota;
+      }
+    }
+    return num_planned;
   }
-  void render (magpie::renderer& renderer)
+
+  /// <summary>
+  /// return chunks emptied by update_chunk to the free list, so any type (or slice) can reuse them
+  /// the remaining chunks keep their order
+  /// </summary>
+  void recycle_empty_chunks ()
   {
-    magpie::printf ("rendering particles\n");
-    for (int i = 0; i < numThreads; ++i) {
-        for (particle const* p : particles[i])
+    for (std::vector <particle_pool>& type_chunks : chunks)
+    {
+      size_t num_kept = 0u;
+      for (particle_pool& chunk : type_chunks)
+      {
+        if (chunk.num_live () == 0u)
+        {
+          give_back_chunk (chunk);
+        }
+        else
         {
-            particle_renderer.draw(renderer,
-                p->position.x, p->position.y,
-                p->colour.r, p->colour.g, p->colour.b, p->colour.a);
+          type_chunks [num_kept++] = chunk;
         }
+      }
+      type_chunks.resize (num_kept);
     }
+  }
 
+  /// <summary>
+  /// chunks slowly empty as their particles expire, but only go back to the free list once completely empty,
+  /// so a type could hold on to many part empty chunks while another type runs out
+  /// whenever a type's chunks have room for all the particles of its emptiest chunk, they are moved into that room
+  /// this keeps every type within one chunk of the fewest it could use, so the slice never needs more than chunks_needed
+  /// </summary>
+  void compact_chunks ()
+  {
+    for (std::vector <particle_pool>& type_chunks : chunks)
+    {
+      while (type_chunks.size () > 1u)
+      {
+        // move the emptiest chunk to the end
+        size_t emptiest = 0u;
+        unsigned room = 0u;
+        for (size_t i = 0u; i < type_chunks.size (); ++i)
+        {
+          room += type_chunks [i].capacity - type_chunks [i].count;
+          emptiest = type_chunks [i].count < type_chunks [emptiest].count ? i : emptiest;
+        }
+        std::swap (type_chunks [emptiest], type_chunks.back ());
 
-    ////////////////////////////////////////////////
-    //// DO NOT EDIT/DELETE/MOVE CODE BELOW >>> ////
-    ////////////////////////////////////////////////
-
-
-    particle_renderer.render (renderer);
+        particle_pool& last = type_chunks.back ();
+        room -= last.capacity - last.count;
+        if (room < last.count)
+        {
+          break;
+        }
 
+        for (size_t i = 0u; last.count > 0u; ++i)
+        {
+          particle_pool& chunk = type_chunks [i];
+          unsigned const chunk_room = chunk.capacity - chunk.count;
+          unsigned const num_moved = chunk_room < last.count ? chunk_room : last.count;
+          unsigned const from = last.count - num_moved;
+          std::copy_n (last.position_x + from, num_moved, chunk.position_x + chunk.count);
+          std::copy_n (last.position_y + from, num_moved, chunk.position_y + chunk.count);
+          std::copy_n (last.velocity_x + from, num_moved, chunk.velocity_x + chunk.count);
+          std::copy_n (last.velocity_y + from, num_moved, chunk.velocity_y + chunk.count);
+          std::copy_n (last.inv_life_time + from, num_moved, chunk.inv_life_time + chunk.count);
+          std::copy_n (last.life_remaining + from, num_moved, chunk.life_remaining + chunk.count);
+          std::copy_n (last.spawn_time + from, num_moved, chunk.spawn_time + chunk.count);
+          chunk.count += num_moved;
+          last.count = from;
+        }
 
-    ////////////////////////////////////////////////
-    //// <<< DO NOT EDIT/DELETE/MOVE CODE ABOVE ////
-    ////////////////////////////////////////////////
+        give_back_chunk (last);
+        type_chunks.pop_back ();
+      }
+    }
   }
 
-  void release(magpie::renderer& renderer)
+  /// <summary>
+  /// move a free chunk to the end of a type's chunks, this slice's own free chunks first, then other slices' spare chunks
+  /// </summary>
+  /// <param name="allow_overflow">allocate a chunk from the heap if the arena has no free chunks left</param>
+  /// <returns>true, if a chunk was added</returns>
+  bool take_free_chunk (unsigned type, bool allow_overflow = true)
   {
-      ////////////////////////////////////////////////
-      //// DO NOT EDIT/DELETE/MOVE CODE BELOW >>> ////
-      ////////////////////////////////////////////////
-
-
-      particle_renderer.release(renderer);
+    particle_pool chunk;
+    if (!overflow_chunks.empty ())
+    {
+      chunk = overflow_chunks.back ();
+      overflow_chunks.pop_back ();
+    }
+    else if (!arena->take_chunk (free_list, chunk))
+    {
+      if (!allow_overflow)
+      {
+        return false;
+      }
 
+      // out of arena chunks, should never happen while every slice stays within its budget
+      MAGPIE_DASSERT_MSG (false, "particle slice has run out of arena chunks");
+      overflow_storage.emplace_back (new float [(size_t)PARTICLE_CHUNK_SIZE * particle_pool::NUM_ARRAYS]);
+      chunk.attach (overflow_storage.back ().get (), PARTICLE_CHUNK_SIZE);
+      heap_allocations++;
+    }
 
-      ////////////////////////////////////////////////
-      //// <<< DO NOT EDIT/DELETE/MOVE CODE ABOVE ////
-      ////////////////////////////////////////////////
+    std::vector <particle_pool>& type_chunks = chunks [type];
+    if (type_chunks.size () == type_chunks.capacity ())
+    {
+      heap_allocations++;
+    }
+    type_chunks.push_back (chunk);
+    return true;
+  }
 
+  /// <summary>
+  /// return an empty chunk to the arena's free list, or to this slice if it was allocated after the arena ran out
+  /// </summary>
+  void give_back_chunk (particle_pool const& chunk)
+  {
+    particle_pool empty = chunk;
+    empty.count = empty.first = empty.spawn_quota = 0u;
+    if (empty.chunk_index == ~0u)
+    {
+      overflow_chunks.push_back (empty);
+    }
+    else
+    {
+      arena->give_back_chunk (empty);
+    }
+  }
 
+  void release ()
+  {
+    chunks.clear ();
+    overflow_chunks.clear ();
+    overflow_storage.clear ();
+    arena = nullptr;
+  }
 
-      // delete all particles
-      for (int i = 0; i < numThreads; ++i) 
-      {
+  std::vector <std::vector <particle_pool>> chunks; // each type's chunks, indexed by type
 
+  particle_arena* arena = nullptr; // where the slice's chunks come from
+  unsigned free_list = 0u;         // the arena free list holding this slice's own chunks
 
-          std::vector <particle*>::iterator it = particles[i].begin();
-          while (it != particles[i].end())
-          {
-              // get pointer to particle from iterator
-              particle* p = *it;
+  unsigned heap_allocations = 0u; // heap allocations made by emit, reset by the particle system every frame
+  std::vector <std::unique_ptr <float []>> overflow_storage; // chunks allocated after the arena ran out
+  std::vector <particle_pool> overflow_chunks; // free chunks of overflow_storage
+};
 
-              // release data previously allocated for this particle
-              // no effect if p == nullptr
-              delete p;
+/// <summary>
+/// update all active particles of a single type
+/// remove expired particles
+/// the unfused pass, the frame uses update_chunk & only the benchmarks call this (so it is inline)
+/// </summary>
+/// <param name="particles">pool of particles, all of one type</param>
+/// <param name="type">the particles' type</param>
+/// <param name="elapsed_seconds">elapsed frame time</param>
+inline void process (particle_pool& particles, particle_type_desc const& type, float elapsed_seconds)
+{
+  // velocity change is the same for every particle of this type
+  float const delta_velocity_x = type.acceleration.x * elapsed_seconds;
+  float const delta_velocity_y = type.acceleration.y * elapsed_seconds;
+  float const kill_y = type.kill_y;
+
+  // update linear motion & life remaining, see particle_simd.h
+  particle_integrate () (particles.position_x, particles.position_y,
+    particles.velocity_x, particles.velocity_y, particles.life_remaining, particles.count,
+    elapsed_seconds, delta_velocity_x, delta_velocity_y);
+
+  // remove expired particles
+  // expired particles are replaced by the last particle, so the index only moves on when the current particle survives
+  unsigned i = 0u;
+  while (i < particles.count)
+  {
+    if (particles.life_remaining [i] <= 0.0f || particles.position_y [i] < kill_y)
+    {
+      particles.kill (i);
+    }
+    else
+    {
+      i++;
+    }
+  }
+}
+
+/// <summary>
+/// a vertex that draws nothing, for vertex slots left over when a chunk loses more particles than it spawns
+/// (transparent & off the right hand side of the screen)
+/// </summary>
+static sf::Vertex const EMPTY_VERTEX = particle_renderer_2d::make_vertex ((float)SCREEN_WIDTH, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f);
+
+/// <summary>
+/// number of particles integrated at a time by update_chunk, small enough to still be in L1 when the block is revisited
+/// </summary>
+static unsigned const PARTICLE_BLOCK_SIZE = 256u;
+
+/// <summary>
+/// estimated bytes read & written per live particle per frame, reported by the headless build
+/// separate passes: process reads & writes 5 floats, its expiry loop reads 2 floats again,
+///                  render reads 4 floats & writes a vertex
+/// fused pass:      update_chunk reads 6 floats & writes 5 floats & a vertex, once (its colour comes from a table in L1)
+/// </summary>
+static unsigned const SEPARATE_PASSES_BYTES_PER_PARTICLE = (5u + 5u + 2u + 4u) * (unsigned)sizeof (float) + (unsigned)sizeof (sf::Vertex);
+static unsigned const FUSED_PASS_BYTES_PER_PARTICLE = (6u + 5u) * (unsigned)sizeof (float) + (unsigned)sizeof (sf::Vertex);
+
+/// <summary>
+/// estimated bytes read & written per live particle per frame in analytic mode:
+/// update_chunk_analytic reads 7 floats & writes only a vertex (new particles are merged into the last chunk of each type, not counted)
+/// </summary>
+static unsigned const ANALYTIC_PASS_BYTES_PER_PARTICLE = 7u * (unsigned)sizeof (float) + (unsigned)sizeof (sf::Vertex);
+
+/// <summary>
+/// the whole frame for a chunk in one sweep through its memory:
+/// integrate, remove expired particles, spawn the chunk's spawn_quota & write every particle's vertex
+/// particles are integrated a block at a time with the selected kernel (see particle_simd.h),
+/// then each particle in the block is checked, replaced & written while the block is still in cache
+/// new particles fill the slots of expired particles first, then go on the end of the chunk,
+/// they are not integrated in the frame they spawn (as with the separate process & emit passes)
+/// </summary>
+/// <param name="pool">pool of particles, all of one type</param>
+/// <param name="type">the particles' type</param>
+/// <param name="elapsed_seconds">elapsed frame time</param>
+/// <param name="time">unused, only analytic mode needs the time, see update_chunk_analytic</param>
+/// <param name="vertices">room for pool.count + pool.spawn_quota vertices, or nullptr to skip writing vertices</param>
+static void update_chunk (particle_pool& pool, particle_type_desc const& type, float elapsed_seconds, float /*time*/, sf::Vertex* vertices)
+{
+  MAGPIE_DASSERT (pool.count + pool.spawn_quota <= pool.capacity);
+
+  // the type's constants are loaded once per chunk, so the loop below is the same as for a type known at compile time
+  // velocity change is the same for every particle of this type
+  float const delta_velocity_x = type.acceleration.x * elapsed_seconds;
+  float const delta_velocity_y = type.acceleration.y * elapsed_seconds;
+  float const kill_y = type.kill_y;
+  particle_spawn_ranges const spawn = type.spawn;
+  particle_integrate_kernel const integrate = particle_integrate ();
+
+  unsigned const num_vertices = pool.count + pool.spawn_quota;
+  sf::Color const* const colours = type.colours;
+  auto const write_vertex = [&pool, vertices, colours] (unsigned i)
+  {
+    if (vertices)
+    {
+      vertices [i] = sf::Vertex (sf::Vector2f (pool.position_x [i], pool.position_y [i]),
+        colours [particle_colour_index (pool.life_remaining [i], pool.inv_life_time [i])]);
+    }
+  };
+
+  unsigned i = 0u;
+  while (i < pool.count)
+  {
+    unsigned block_end = i + PARTICLE_BLOCK_SIZE < pool.count ? i + PARTICLE_BLOCK_SIZE : pool.count;
+    integrate (pool.position_x + i, pool.position_y + i, pool.velocity_x + i, pool.velocity_y + i, pool.life_remaining + i,
+      block_end - i, elapsed_seconds, delta_velocity_x, delta_velocity_y);
+
+    while (i < block_end)
+    {
+      if (pool.life_remaining [i] <= 0.0f || pool.position_y [i] < kill_y)
+      {
+        if (pool.spawn_quota > 0u)
+        {
+          // reuse the slot for a new particle
+          initialise_particle (pool, i, pool.random, spawn);
+          pool.spawn_quota--;
+        }
+        else
+        {
+          // replace with the last particle, integrating it first if it is beyond this block
+          unsigned const last = pool.count - 1u;
+          pool.kill (i);
+          if (last >= block_end)
+          {
+            integrate_scalar (pool.position_x + i, pool.position_y + i, pool.velocity_x + i, pool.velocity_y + i,
+              pool.life_remaining + i, 1u, elapsed_seconds, delta_velocity_x, delta_velocity_y);
+          }
+          else
+          {
+            block_end = pool.count < block_end ? pool.count : block_end;
+          }
+          continue; // check the particle now in slot i
+        }
+      }
+
+      write_vertex (i);
+      i++;
+    }
+  }
+
+  // spawns that did not fit in expired slots go on the end, initialised together
+  if (pool.spawn_quota > 0u)
+  {
+    unsigned const first = pool.count;
+    pool.count += pool.spawn_quota;
+    pool.spawn_quota = 0u;
+
+    random_batch_engine batch_random (pool.random.next64 ());
+    initialise_particles (pool, first, pool.count - first, batch_random, spawn);
+    for (unsigned index = first; index < pool.count; ++index)
+    {
+      write_vertex (index);
+    }
+  }
+
+  // slots freed but not refilled still have a vertex reserved
+  if (vertices)
+  {
+    for (unsigned v = pool.count; v < num_vertices; ++v)
+    {
+      vertices [v] = EMPTY_VERTEX;
+    }
+  }
+}
+
+/// <summary>
+/// age at which a particle first falls below kill_y, solving position_y + velocity_y * age + acceleration.y * age^2 / 2 = kill_y
+/// </summary>
+/// <returns>the age, or infinity if the particle never falls below kill_y</returns>
+static float kill_y_age (particle_type_desc const& type, float position_y, float velocity_y)
+{
+  float const height = position_y - type.kill_y;
+  if (height < 0.0f)
+  {
+    return 0.0f;
+  }
+
+  if (type.acceleration.y == 0.0f)
+  {
+    return velocity_y < 0.0f ? height / -velocity_y : std::numeric_limits <float>::infinity ();
+  }
+
+  // with acceleration down this is the later root (on the way down), with acceleration up it is the earlier root,
+  // a negative root or no root at all means it never gets below kill_y
+  float const discriminant = velocity_y * velocity_y - 2.0f * type.acceleration.y * height;
+  if (discriminant < 0.0f)
+  {
+    return std::numeric_limits <float>::infinity ();
+  }
+  float const age = (-velocity_y - std::sqrt (discriminant)) / type.acceleration.y;
+  return age >= 0.0f ? age : std::numeric_limits <float>::infinity ();
+}
+
+/// <summary>
+/// give particles [first, first + count) new spawn values, for analytic mode
+/// life_remaining is each particle's life at spawn_time, cut short to when it falls below kill_y,
+/// so a particle has expired once its age reaches life_remaining
+/// </summary>
+static void initialise_analytic_batch (particle_pool& pool, particle_type_desc const& type, unsigned first, unsigned count,
+  random_batch_engine& random, float time)
+{
+  initialise_particles (pool, first, count, random, type.spawn);
+
+  for (unsigned i = first; i < first + count; ++i)
+  {
+    float const kill_age = kill_y_age (type, pool.position_y [i], pool.velocity_y [i]);
+    pool.life_remaining [i] = kill_age < pool.life_remaining [i] ? kill_age : pool.life_remaining [i];
+  }
+  std::fill_n (pool.spawn_time + first, count, time);
+}
+
+/// <summary>
+/// time since an analytic particle spawned
+/// </summary>
+/// <param name="spawn_time">time the particle spawned, in [0, PARTICLE_CLOCK_PERIOD)</param>
+/// <param name="time">current time, in [0, PARTICLE_CLOCK_PERIOD)</param>
+static float particle_age (float spawn_time, float time)
+{
+  float const age = time - spawn_time;
+  return age < 0.0f ? age + PARTICLE_CLOCK_PERIOD : age; // the clock has wrapped since the particle spawned
+}
+
+/// <summary>
+/// scratch space for merging new particles into a chunk's death order, one per thread
+/// grows to the largest chunk the thread has merged into, then is reused
+/// </summary>
+struct particle_merge_scratch
+{
+  std::vector <float> keys;       // time until each particle dies
+  std::vector <unsigned> order;   // the chunk's old particles, then its new particles sorted by death
+  std::vector <unsigned> merged;  // every particle in death order
+  std::vector <float> values;     // an array of the chunk, in death order
+};
+
+static particle_merge_scratch& thread_merge_scratch ()
+{
+  thread_local particle_merge_scratch scratch;
+  return scratch;
+}
+
+/// <summary>
+/// spawn a death ordered chunk's spawn_quota & merge the new particles into death order with the live particles
+/// only the last chunk of each type spawns, so this is the only place particles of a death ordered chunk are moved
+/// </summary>
+/// <param name="pool">chunk whose expired particles have already been skipped (pool.first)</param>
+/// <param name="type">the chunk's particle type</param>
+/// <param name="time">current time, the new particles' spawn time</param>
+static void spawn_in_death_order (particle_pool& pool, particle_type_desc const& type, float time)
+{
+  float* const arrays [particle_pool::NUM_ARRAYS] = { pool.position_x, pool.position_y, pool.velocity_x, pool.velocity_y,
+    pool.inv_life_time, pool.life_remaining, pool.spawn_time };
+
+  // close the gap left by expired particles
+  if (pool.first > 0u)
+  {
+    for (float* array : arrays)
+    {
+      std::copy (array + pool.first, array + pool.count, array);
+    }
+    pool.count -= pool.first;
+    pool.first = 0u;
+  }
+
+  unsigned const num_old = pool.count;
+  pool.count += pool.spawn_quota;
+  pool.spawn_quota = 0u;
+  random_batch_engine batch_random (pool.random.next64 ());
+  initialise_analytic_batch (pool, type, num_old, pool.count - num_old, batch_random, time);
+
+  // the old particles are already in death order, sort the new particles & merge the two
+  particle_merge_scratch& scratch = thread_merge_scratch ();
+  scratch.keys.resize (pool.count);
+  scratch.order.resize (pool.count);
+  scratch.merged.resize (pool.count);
+  scratch.values.resize (pool.count);
+  for (unsigned i = 0u; i < pool.count; ++i)
+  {
+    scratch.keys [i] = pool.life_remaining [i] - particle_age (pool.spawn_time [i], time);
+    scratch.order [i] = i;
+  }
+
+  float const* const keys = scratch.keys.data ();
+  auto const dies_sooner = [keys] (unsigned a, unsigned b)
+  {
+    return keys [a] < keys [b];
+  };
+  unsigned* const order = scratch.order.data ();
+  std::sort (order + num_old, order + pool.count, dies_sooner);
+  std::merge (order, order + num_old, order + num_old, order + pool.count, scratch.merged.data (), dies_sooner);
+
+  for (float* array : arrays)
+  {
+    for (unsigned i = 0u; i < pool.count; ++i)
+    {
+      scratch.values [i] = array [scratch.merged [i]];
+    }
+    std::copy_n (scratch.values.data (), pool.count, array);
+  }
+}
+
+/// <summary>
+/// analytic mode's equivalent of update_chunk, for a death ordered chunk:
+/// skip the expired particles at the front, spawn the chunk's spawn_quota & write every live particle's vertex,
+/// with each position & colour evaluated from the particle's spawn state at its current age
+/// particles that survive are only read, never written
+/// </summary>
+/// <param name="pool">pool of particles, all of one type, spawned by initialise_analytic_batch & in death order</param>
+/// <param name="type">the particles' type</param>
+/// <param name="elapsed_seconds">unused, a particle's age comes from the time</param>
+/// <param name="time">current time, in [0, PARTICLE_CLOCK_PERIOD)</param>
+/// <param name="vertices">room for pool.num_live () + pool.spawn_quota vertices, or nullptr to skip writing vertices</param>
+static void update_chunk_analytic (particle_pool& pool, particle_type_desc const& type, float /*elapsed_seconds*/, float time,
+  sf::Vertex* vertices)
+{
+  MAGPIE_DASSERT (pool.num_live () + pool.spawn_quota <= pool.capacity);
+
+  unsigned const num_vertices = pool.num_live () + pool.spawn_quota;
+
+  // the particles are in death order, so only the particles that have expired are checked, plus the first survivor
+  // (death times a rounding error apart can be out of order, the later of the two then expires a frame late)
+  while (pool.first < pool.count && particle_age (pool.spawn_time [pool.first], time) >= pool.life_remaining [pool.first])
+  {
+    pool.first++;
+  }
+
+  if (pool.spawn_quota > 0u)
+  {
+    spawn_in_death_order (pool, type, time);
+  }
+
+  if (!vertices)
+  {
+    return;
+  }
+
+  // the type's constants are loaded once per chunk, see update_chunk
+  float const acceleration_x = type.acceleration.x;
+  float const acceleration_y = type.acceleration.y;
+  sf::Color const* const colours = type.colours;
+  sf::Vertex* vertex = vertices;
+  for (unsigned i = pool.first; i < pool.count; ++i)
+  {
+    float const age = particle_age (pool.spawn_time [i], time);
+    float const half_age_squared = 0.5f * age * age;
+    float const position_x = pool.position_x [i] + pool.velocity_x [i] * age + acceleration_x * half_age_squared;
+    float const position_y = pool.position_y [i] + pool.velocity_y [i] * age + acceleration_y * half_age_squared;
+
+    // life ratio is (life_time - age) / life_time
+    *vertex++ = sf::Vertex (sf::Vector2f (position_x, position_y),
+      colours [particle_colour_index (1.0f - age * pool.inv_life_time [i], 1.0f)]);
+  }
+
+  // slots freed but not refilled still have a vertex reserved
+  for (; vertex < vertices + num_vertices; ++vertex)
+  {
+    *vertex = EMPTY_VERTEX;
+  }
+}
+
+/// <summary>
+/// signature shared by update_chunk & update_chunk_analytic
+/// </summary>
+typedef void (*particle_update_function) (particle_pool&, particle_type_desc const&, float, float, sf::Vertex*);
+
+/// <summary>
+/// spread num_spawns particles between the types by their shares, as spawn quotas for the slice's chunks
+/// each type gets the particles between its cumulative share's start & end, rounded down, so the types always add up to num_spawns
+/// </summary>
+/// <returns>number of particles planned, less than num_spawns only if the slice ran out of chunks</returns>
+static unsigned plan_type_spawns (particle_slice& particles, std::vector <particle_type_desc> const& types, unsigned num_spawns)
+{
+  float total_share = 0.0f;
+  for (particle_type_desc const& type : types)
+  {
+    total_share += type.share;
+  }
+  unsigned num_planned = 0u, type_end = 0u;
+  float cumulative_share = 0.0f;
+  for (unsigned type = 0u; type < (unsigned)types.size (); ++type)
+  {
+    unsigned const type_start = type_end;
+    cumulative_share += types [type].share;
+    type_end = type + 1u == types.size () || total_share <= 0.0f ? num_spawns
+      : (unsigned)((double)num_spawns * cumulative_share / total_share);
+    type_end = type_end < type_start ? type_start : type_end;
+    num_planned += particles.plan_spawns (type, type_end - type_start);
+  }
+  return num_planned;
+}
+
+/// <summary>
+/// decide how many new particles each of the slice's chunks gets this frame
+/// the particles are created by update_chunk, in slots freed by expired particles where possible
+/// </summary>
+/// <param name="particles">slice of particles</param>
+/// <param name="types">the particle types, one list of chunks in the slice per type</param>
+/// <param name="elapsed_seconds">elapsed frame time</param>
+/// <param name="budget">the frame's spawns shared by every slice, with particles.budget_share set,
+/// or nullptr for the slice to keep to its own max_particles & spawn rate</param>
+static void emit (particle_slice& particles, std::vector <particle_type_desc> const& types, float elapsed_seconds,
+  particle_budget* budget = nullptr)
+{
+  particles.recycle_empty_chunks ();
+  if (!particles.death_ordered)
+  {
+    particles.compact_chunks (); // would break the death order
+  }
+  for (std::vector <particle_pool>& type_chunks : particles.chunks)
+    for (particle_pool& chunk : type_chunks)
+      chunk.spawn_quota = 0u;
+
+  // the whole frame's spawns are worked out here, update_chunk then initialises each chunk's share together
+  unsigned num_spawns = 0u, num_planned = 0u;
+  if (budget)
+  {
+    // this slice's share first, then any spawns other slices could not use, a block at a time
+    // (the budget is already cut to the room left under PARTICLE_MAX, see particle_system_t::share_budget)
+    num_spawns = budget->reserve (particles.budget_share);
+    num_planned = plan_type_spawns (particles, types, num_spawns);
+    while (num_planned == num_spawns)
+    {
+      unsigned const block = budget->reserve (PARTICLE_BUDGET_BLOCK);
+      if (block == 0u)
+      {
+        break;
+      }
+      num_spawns += block;
+      num_planned += plan_type_spawns (particles, types, block);
+    }
+    budget->give_back (num_spawns - num_planned);
+  }
+  else
+  {
+    // make sure we never exceed maximum particle budget, nor the frame's particle budget
+    // (particles expiring this frame are not counted as free until the next frame)
+    unsigned const frame_spawns = particles.frame_spawns (elapsed_seconds);
+    unsigned const num_particles = particles.count ();
+    unsigned const room = particles.max_particles - (num_particles < particles.max_particles ? num_particles : particles.max_particles);
+    num_spawns = frame_spawns < room ? frame_spawns : room; // no message when full, main reports whether every particle is active
+    num_planned = plan_type_spawns (particles, types, num_spawns);
+  }
+
+  if (num_planned < num_spawns)
+  {
+    magpie::printf ("out of free chunks, %u particles not spawned\n", num_spawns - num_planned);
+  }
+  particles.num_spawned = num_planned;
+}
+
+/// <summary>
+/// a single chunk to update, the unit of work for the work stealing scheduler
+/// </summary>
+struct particle_task
+{
+  particle_pool* chunk;
+  particle_type_desc const* type;
+  particle_update_function update;
+  unsigned first_vertex; // where the chunk's vertices start in the vertex array
+};
+
+class particle_system_t
+{
+public:
+  /// <summary>
+  /// start the worker threads & allocate the vertex array
+  /// </summary>
+  /// <param name="config">run time settings, see config.h</param>
+  bool initialise (magpie::renderer& /*renderer*/, particle_system_config const& config = {})
+  {
+    if (!initialise (config))
+    {
+      return false;
+    }
+    return render_mode != particle_render_mode::software || software_renderer.initialise_texture ();
+  }
+
+  /// <summary>
+  /// start the worker threads & allocate the vertex array, no renderer needed (e.g. headless)
+  /// </summary>
+  /// <param name="config">run time settings, see config.h</param>
+  bool initialise (particle_system_config const& config = {})
+  {
+    // pick the integration kernel now rather than in the first frame
+    magpie::printf ("particle integration kernel: %s\n", particle_integrate_kernel_name (particle_integrate ()));
+
+    types = particle_types_from_file (config.emitters_path);
+    magpie::printf ("particle types: %u (", (unsigned)types.size ());
+    for (size_t i = 0u; i < types.size (); ++i)
+    {
+      magpie::printf ("%s%s", i > 0u ? ", " : "", types [i].name);
+    }
+    magpie::printf (")\n");
+    unsigned const num_types = (unsigned)types.size ();
+
+    unsigned const num_threads = config.num_threads > 0u ? config.num_threads : default_thread_count ();
+
+    // one slice per thread, the capacity (PARTICLE_MAX by default) & spawn rate are shared as evenly as possible
+    // each slice has its own random stream, seeded independently of the others
+    max_particles = config.max_particles;
+    unsigned const spawn_per_frame = config.spawn_per_frame;
+    std::uint64_t seed_state = config.deterministic ? config.seed : random_base_seed ();
+    particles.resize (num_threads);
+    unsigned num_chunks = 0u;
+    for (unsigned i = 0u; i < num_threads; ++i)
+    {
+      particles [i].max_particles = max_particles / num_threads + (i < max_particles % num_threads ? 1u : 0u);
+      particles [i].spawn_rate = spawn_per_frame / num_threads + (i < spawn_per_frame % num_threads ? 1u : 0u);
+      particles [i].spawn_per_second = config.spawn_per_second / (float)num_threads;
+      particles [i].spawn_carry = 0.0f;
+      particles [i].random.seed (splitmix64 (seed_state));
+      particles [i].death_ordered = config.analytic;
+      num_chunks += particle_slice::chunks_needed (particles [i].max_particles, num_types, config.analytic);
+    }
+
+    // every chunk any slice can need is allocated now, each slice gets its own free list of them,
+    // so spawning & killing never touch the heap after this
+    if (!arena.initialise (PARTICLE_CHUNK_SIZE, num_chunks, num_threads, config.huge_pages))
+    {
+      magpie::printf ("particle system: could not reserve %u chunks for %u particles\n", num_chunks, max_particles);
+      return false;
+    }
+    unsigned first_chunk = 0u;
+    for (unsigned i = 0u; i < num_threads; ++i)
+    {
+      particle_slice& slice = particles [i];
+      unsigned const slice_chunks = particle_slice::chunks_needed (slice.max_particles, num_types, slice.death_ordered);
+      slice.initialise (arena, i, first_chunk, slice_chunks, num_types);
+      first_chunk += slice_chunks;
+    }
+    tasks.reserve (num_chunks);
+    magpie::printf ("particle system: %u particles, %u spawned per frame\n", max_particles, spawn_per_frame);
+    magpie::printf ("particle system: %u chunks, %.1f MB arena reserved, %s pages\n", num_chunks,
+      (double)arena.get_size_bytes () / (1024.0 * 1024.0), arena.has_huge_pages () ? "huge" : "normal");
+
+    if (!workers.initialise (num_threads))
+    {
+      return false;
+    }
+    scheduler.initialise (num_threads, config.work_stealing);
+    magpie::printf ("particle system: %u worker threads, work stealing %s\n", num_threads, config.work_stealing ? "on" : "off");
+
+    // place every thread before it takes (& so first writes) any of its slice's chunks, so their memory is on its node
+    // (see thread_placement.h)
+    placement.initialise (cpu_topology::detect (), config.affinity, num_threads);
+    slice_nodes.assign (num_threads, 0u);
+    traffic = std::vector <thread_traffic> (num_threads);
+    finished_traffic = traffic;
+    std::atomic <unsigned> num_unpinned = { 0u };
+    auto place_job = [this, &num_unpinned] (unsigned thread_index)
+    {
+      if (!placement.apply (thread_index))
+      {
+        num_unpinned.fetch_add (1u, std::memory_order_relaxed);
+      }
+      slice_nodes [thread_index] = placement.current_node (thread_index);
+    };
+    workers.run (place_job);
+    magpie::printf ("particle system: %u memory nodes, threads pinned to %s", placement.get_num_nodes (),
+      config.affinity == thread_affinity::none ? "nothing" : thread_affinity_name (config.affinity));
+    magpie::printf (num_unpinned.load () > 0u ? ", %u threads could not be pinned\n" : "\n", num_unpinned.load ());
+    if (config.spawn_per_second > 0.0f)
+    {
+      magpie::printf ("particle system: emitting %.0f particles per second\n", config.spawn_per_second);
+    }
+    // a shared budget depends on which slice reserves first, so replays keep a fixed budget per slice
+    shared_budget = config.shared_budget && !config.deterministic;
+    magpie::printf ("particle system: %s budget\n", shared_budget ? "shared" : "fixed per thread");
+    analytic = config.analytic;
+    clock = 0.0;
+    if (analytic)
+    {
+      magpie::printf ("particle system: analytic motion\n");
+    }
+    // replays check every frame's particles right after update, so never leave a pass in flight
+    pipelined = config.pipelined && !config.deterministic;
+    if (pipelined)
+    {
+      magpie::printf ("particle system: pipelined, drawing each frame while the next is simulated\n");
+      if (!back_renderer.initialise (max_particles))
+      {
+        return false;
+      }
+    }
+    render_mode = config.render_mode;
+    if (render_mode == particle_render_mode::software)
+    {
+      // every vertex is drawn by the tiles in order anyway
+      magpie::printf ("particle system: %s renderer, %ux%u tiles%s\n", particle_render_mode_name (render_mode),
+        software_renderer_2d::TILE_SIZE, software_renderer_2d::TILE_SIZE, config.cull != vertex_cull_mode::none ? ", SHOT2_CULL ignored" : "");
+      scratch_vertices.resize (max_particles);
+      software_renderer.initialise (num_threads, max_particles, sf::Color::Black); // main clears the window to black
+    }
+    vertex_cull_mode const cull = render_mode == particle_render_mode::software ? vertex_cull_mode::none : config.cull;
+    culler.initialise (cull);
+    if (cull != vertex_cull_mode::none)
+    {
+      magpie::printf ("particle system: culling vertices, %s\n", vertex_cull_mode_name (cull));
+      scratch_vertices.resize (max_particles);
+      cull_offsets.assign (num_threads, 0u);
+    }
+    if (config.deterministic)
+    {
+      magpie::printf ("particle system: deterministic replay, seed %llu, elapsed %fs per frame\n",
+        (unsigned long long)config.seed, config.fixed_elapsed_seconds);
+    }
+
+    // the main thread also runs worker 0's share of every job
+    trace_recorder::get ().name_thread ("main", 0u);
+    if (config.trace_path)
+    {
+      trace_recorder::get ().start (config.trace_path, config.trace_events);
+      for (unsigned i = 0u; i < num_threads; ++i)
+      {
+        worker_series.push_back (profile_intern ("worker " + std::to_string (i)));
+      }
+    }
+
+    //Resizes the variable containing the maximum number of particles (verticies) 
+    return particle_renderer.initialise (max_particles);
+
+
+  }
+  void update (float elapsed_seconds, long long& num_active_particles)
+  {
+    PROFILE_ZONE ("particle_system_t::update");
+    sync ();
+    long long const num_before = get_num_particles ();
+
+    // each thread plans its own slice's spawns
+    Timer phase_timer;
+    phase_timer.start ();
+    if (shared_budget)
+    {
+      share_budget (elapsed_seconds, num_before);
+    }
+    auto emit_job = [this, elapsed_seconds] (unsigned thread_index)
+    {
+      PROFILE_ZONE ("emit");
+      particles [thread_index].heap_allocations = 0u;
+      emit (particles [thread_index], types, elapsed_seconds, shared_budget ? &budget : nullptr);
+    };
+    workers.run (emit_job);
+    phase_timer.stop ();
+    timings.emit_ms = phase_timer.get_elapsed_ms ();
+
+    heap_allocations = 0u;
+    for (particle_slice const& slice : particles)
+    {
+      heap_allocations += slice.heap_allocations;
+    }
+
+    // list every chunk, each with its own range of the vertex array
+    size_t const task_capacity = tasks.capacity ();
+    unsigned const num_vertices = build_tasks ();
+    heap_allocations += tasks.capacity () != task_capacity ? 1u : 0u;
+
+    // the clock is kept in double precision & handed to the chunks wrapped, see PARTICLE_CLOCK_PERIOD
+    clock += elapsed_seconds;
+    float const time = (float)std::fmod (clock, (double)PARTICLE_CLOCK_PERIOD);
+
+    // update every chunk in a single pass, threads that run out of chunks steal from the others
+    // when pipelined the pass writes the back vertex array & is finished by the next update, see the top of this file
+    // when culling or rasterising, the pass writes the scratch array & the renderer's is filled (or left empty) afterwards
+    particle_renderer_2d& target = pipelined ? back_renderer : particle_renderer;
+    if (!scratch_vertices.empty ())
+    {
+      unsigned const max_vertices = num_vertices < (unsigned)scratch_vertices.size () ? num_vertices : (unsigned)scratch_vertices.size ();
+      pass = { this, elapsed_seconds, time, scratch_vertices.data (), max_vertices };
+    }
+    else
+    {
+      sf::Vertex* const vertices = target.reserve (num_vertices);
+      pass = { this, elapsed_seconds, time, vertices, target.get_num_vertices () };
+    }
+    pass_num_before = num_before;
+    if (pipelined)
+    {
+      workers.dispatch (pass);
+      num_active_particles = counts.num_particles; // the last finished update's, the one drawn this frame
+      return;
+    }
+
+    phase_timer.start ();
+    workers.run (pass);
+    phase_timer.stop ();
+    timings.update_ms = phase_timer.get_elapsed_ms ();
+
+    cull_vertices_into (target);
+    rasterise_vertices ();
+    finish_update ();
+    num_active_particles = counts.num_particles;
+  }
+
+  /// <summary>
+  /// throw away the vertices written by update without drawing them (e.g. headless)
+  /// </summary>
+  /// <returns>number of vertices discarded</returns>
+  unsigned discard_vertices ()
+  {
+    unsigned const num_vertices = particle_renderer.get_num_vertices ();
+    particle_renderer.discard ();
+    return num_vertices;
+  }
+
+  /// <summary>
+  /// time taken by each phase of the last update
+  /// </summary>
+  struct phase_timings
+  {
+    float emit_ms = 0.0f;   // planning spawns
+    float update_ms = 0.0f; // the fused pass, integrate, expire, spawn & write vertices (the slowest thread's, when pipelined)
+    float wait_ms = 0.0f;   // pipelined only, the main thread waiting for the pass in flight
+    float cull_ms = 0.0f;   // culling only, compacting the vertices that are drawn
+    float raster_ms = 0.0f; // software renderer only, drawing the vertices into the framebuffer
+  };
+
+  phase_timings const& get_timings () const
+  {
+    return timings;
+  }
+
+  /// <summary>
+  /// particle counts from the last update
+  /// </summary>
+  struct frame_counts
+  {
+    long long num_particles = 0; // active at the end of the update
+    unsigned num_spawned = 0u;
+    unsigned num_killed = 0u;    // expired during the update
+    unsigned num_vertices = 0u;  // written by the update
+    unsigned num_drawn = 0u;     // left to draw, fewer than num_vertices when culling, only those on screen for the software renderer
+  };
+
+  frame_counts const& get_counts () const
+  {
+    return counts;
+  }
 
-          }
-          //clears the vector when closing program
-          particles[i].clear();
+  /// <summary>
+  /// hash of every particle's state (FNV-1a over the raw bits), in slice, type & chunk order
+  /// identical particle states always give identical checksums, so two builds can be compared frame by frame
+  /// </summary>
+  std::uint64_t get_checksum ()
+  {
+    sync ();
+
+    // hash chunks in parallel, then combine the chunk hashes in order
+    std::vector <particle_pool const*> chunks;
+    for (particle_slice const& slice : particles)
+      for (std::vector <particle_pool> const& type_chunks : slice.chunks)
+        for (particle_pool const& chunk : type_chunks)
+          chunks.push_back (&chunk);
+
+    std::vector <std::uint64_t> chunk_hashes (chunks.size ());
+    unsigned const num_threads = workers.size ();
+    bool const analytic = this->analytic;
+    auto hash_job = [&chunks, &chunk_hashes, num_threads, analytic] (unsigned thread_index)
+    {
+      for (size_t i = thread_index; i < chunks.size (); i += num_threads)
+      {
+        particle_pool const& chunk = *chunks [i];
+        unsigned const first = chunk.first, num_live = chunk.num_live ();
+        std::uint64_t hash = fnv1a (FNV_OFFSET, &num_live, sizeof (num_live));
+        hash = fnv1a (hash, chunk.position_x + first, num_live * sizeof (float));
+        hash = fnv1a (hash, chunk.position_y + first, num_live * sizeof (float));
+        hash = fnv1a (hash, chunk.velocity_x + first, num_live * sizeof (float));
+        hash = fnv1a (hash, chunk.velocity_y + first, num_live * sizeof (float));
+        hash = fnv1a (hash, chunk.inv_life_time + first, num_live * sizeof (float));
+        hash = fnv1a (hash, chunk.life_remaining + first, num_live * sizeof (float));
+        if (analytic)
+        {
+          hash = fnv1a (hash, chunk.spawn_time + first, num_live * sizeof (float)); // never written in stepped mode
+        }
+        chunk_hashes [i] = hash;
       }
+    };
+    workers.run (hash_job);
+
+    return fnv1a (FNV_OFFSET, chunk_hashes.data (), chunk_hashes.size () * sizeof (std::uint64_t));
+  }
+
+  /// <summary>
+  /// total number of active particles
+  /// </summary>
+  long long get_num_particles () const
+  {
+    long long total = 0;
+    for (particle_slice const& slice : particles)
+      total += slice.count ();
+    return total;
+  }
+
+  /// <summary>
+  /// load imbalance of the last update's fused pass, see work_stealing.h
+  /// </summary>
+  float get_load_imbalance () const
+  {
+    return load_imbalance;
+  }
+
+  /// <summary>
+  /// number of chunks processed by a thread other than their owner in the last update
+  /// </summary>
+  unsigned get_chunks_stolen () const
+  {
+    return chunks_stolen;
+  }
+
+  /// <summary>
+  /// heap allocations made by the last update, 0 once the system is running (everything comes from the arena)
+  /// </summary>
+  unsigned get_heap_allocations () const
+  {
+    return heap_allocations;
+  }
+
+  /// <summary>
+  /// number of arena chunks in use
+  /// </summary>
+  unsigned get_chunks_in_use () const
+  {
+    return arena.get_num_chunks () - arena.get_num_free_chunks ();
+  }
+
+  /// <returns>maximum number of particles, PARTICLE_MAX unless SHOT2_MAX_PARTICLES is set</returns>
+  unsigned get_max_particles () const
+  {
+    return max_particles;
+  }
+
+  /// <returns>bytes of particle storage backed by memory, grows as chunks are first used</returns>
+  size_t get_committed_bytes () const
+  {
+    return arena.get_committed_bytes ();
+  }
+
+  /// <returns>true, if every slice shares max_particles & the spawn rate, see particle_budget.h</returns>
+  bool has_shared_budget () const
+  {
+    return shared_budget;
+  }
+
+  /// <summary>
+  /// number of chunks processed in the last update
+  /// </summary>
+  unsigned get_num_chunks () const
+  {
+    return chunks_updated;
+  }
+
+  /// <summary>
+  /// memory traffic of the threads on one node, summed over every update so far
+  /// </summary>
+  struct node_traffic
+  {
+    unsigned num_threads = 0u;       // threads that ran their last pass on the node
+    double particles = 0.0;          // particles updated by those threads
+    double gigabytes_per_second = 0.0; // estimated memory traffic of those particles over the time spent in the update pass
+    unsigned long long local_chunks = 0u, remote_chunks = 0u; // chunks updated with memory on this node / another node
+  };
+
+  /// <returns>each memory node's traffic, see thread_placement.h</returns>
+  std::vector <node_traffic> get_node_traffic () const
+  {
+    std::vector <node_traffic> nodes (placement.get_num_nodes ());
+    double const bytes_per_particle = analytic ? ANALYTIC_PASS_BYTES_PER_PARTICLE : FUSED_PASS_BYTES_PER_PARTICLE;
+    double const update_ns = update_ms_total * 1'000'000.0;
+    for (thread_traffic const& thread : finished_traffic)
+    {
+      node_traffic& node = nodes [thread.node];
+      node.num_threads++;
+      node.particles += (double)thread.particles;
+      node.gigabytes_per_second += update_ns > 0.0 ? bytes_per_particle * (double)thread.particles / update_ns : 0.0; // bytes/ns == GB/s
+      node.local_chunks += thread.local_chunks;
+      node.remote_chunks += thread.remote_chunks;
+    }
+    return nodes;
+  }
+
+  /// <returns>true, if update overlaps the next frame's simulation with drawing this one, see the top of this file</returns>
+  bool is_pipelined () const
+  {
+    return pipelined;
+  }
+
+  particle_render_mode get_render_mode () const
+  {
+    return render_mode;
+  }
+
+  /// <summary>
+  /// the software renderer's framebuffer for the last finished update, see software_renderer.h
+  /// </summary>
+  software_renderer_2d const& get_software_renderer ()
+  {
+    sync ();
+    return software_renderer;
+  }
+
+  /// <summary>
+  /// draw the last finished update's vertices one at a time, as a point list is drawn, & compare with the software renderer's tiles,
+  /// the points are mapped to pixels by point_pixel rather than the tiles' vertex_pixel, so the two cannot agree on a wrong mapping
+  /// </summary>
+  /// <returns>number of pixels that differ, 0 when the software renderer is off</returns>
+  unsigned check_software_frame ()
+  {
+    sync ();
+    if (render_mode != particle_render_mode::software)
+    {
+      return 0u;
+    }
+
+    std::vector <sf::Color> reference ((size_t)SCREEN_WIDTH * SCREEN_HEIGHT, software_renderer.get_clear_colour ());
+    splat_points (scratch_vertices.data (), counts.num_vertices, reference.data ());
+    sf::Color const* const framebuffer = software_renderer.get_framebuffer ();
+    unsigned num_different = 0u;
+    for (size_t i = 0u; i < reference.size (); ++i)
+    {
+      sf::Color const a = reference [i], b = framebuffer [i];
+      num_different += a.r != b.r || a.g != b.g || a.b != b.b || a.a != b.a ? 1u : 0u;
+    }
+    return num_different;
+  }
+  void render (magpie::renderer& renderer)
+  {
+    // the vertices were written by the worker threads during update
+    magpie::printf ("rendering particles\n");
+    PROFILE_ZONE ("particle_renderer_2d::render");
+
+    // the software renderer's framebuffer, the point list is left empty
+    if (render_mode == particle_render_mode::software)
+    {
+      software_renderer.render (renderer);
+    }
+
+
+    ////////////////////////////////////////////////
+    //// DO NOT EDIT/DELETE/MOVE CODE BELOW >>> ////
+    ////////////////////////////////////////////////
+
+
+    particle_renderer.render (renderer);
+
+
+    ////////////////////////////////////////////////
+    //// <<< DO NOT EDIT/DELETE/MOVE CODE ABOVE ////
+    ////////////////////////////////////////////////
+  }
+
+  void release(magpie::renderer& renderer)
+  {
+      sync (); // the pass in flight writes the vertex arrays
+
+      ////////////////////////////////////////////////
+      //// DO NOT EDIT/DELETE/MOVE CODE BELOW >>> ////
+      ////////////////////////////////////////////////
+
+
+      particle_renderer.release(renderer);
+
+
+      ////////////////////////////////////////////////
+      //// <<< DO NOT EDIT/DELETE/MOVE CODE ABOVE ////
+      ////////////////////////////////////////////////
+
+
+
+      release_particles();
+  }
+
+  /// <summary>
+  /// release everything, for a particle system initialised without a renderer (e.g. headless)
+  /// </summary>
+  void release ()
+  {
+    sync ();
+    particle_renderer.release ();
+    release_particles ();
   }
 
+  /// <returns>number of threads used by update</returns>
+  unsigned get_num_threads () const
+  {
+    return (unsigned)particles.size ();
+  }
+
+
 private:
+  /// <summary>
+  /// stop the worker threads & release all particle storage
+  /// </summary>
+  void release_particles ()
+  {
+    sync ();
+    workers.release ();
+    trace_recorder::get ().stop (); // only writes the trace if one was recorded
+
+    for (particle_slice& slice : particles)
+    {
+      slice.release ();
+    }
+    particles.clear ();
+    tasks.clear ();
+    types.clear ();
+    worker_series.clear ();
+    arena.release ();
+    back_renderer.release ();
+    scratch_vertices.clear ();
+    software_renderer.release ();
+  }
+
+  /// <summary>
+  /// one frame's fused pass over every chunk, a member so it outlives update when pipelined
+  /// </summary>
+  struct update_pass
+  {
+    particle_system_t* system;
+    float elapsed_seconds, time;
+    sf::Vertex* vertices;
+    unsigned max_vertices;
+
+    void operator() (unsigned thread_index) const
+    {
+      PROFILE_ZONE ("update");
+      thread_traffic& traffic = system->traffic [thread_index];
+      unsigned const node = system->placement.current_node (thread_index);
+      traffic.node = node;
+      system->scheduler.execute (thread_index, [this, &traffic, node] (unsigned task)
+      {
+        PROFILE_ZONE ("process & fill vertices"); // one chunk, see update_chunk
+        particle_task const& chunk_task = system->tasks [task];
+
+        // count the chunk against the node its memory is on
+        traffic.particles += chunk_task.chunk->num_live () + chunk_task.chunk->spawn_quota;
+        unsigned const chunk_index = chunk_task.chunk->chunk_index;
+        if (chunk_index < system->arena.get_num_chunks ())
+        {
+          (system->slice_nodes [system->arena.get_home_list (chunk_index)] == node ? traffic.local_chunks : traffic.remote_chunks)++;
+        }
+
+        bool const fits = chunk_task.first_vertex + chunk_task.chunk->num_live () + chunk_task.chunk->spawn_quota <= max_vertices;
+        chunk_task.update (*chunk_task.chunk, *chunk_task.type, elapsed_seconds, time, fits ? vertices + chunk_task.first_vertex : nullptr);
+      });
+    }
+  };
+
+  /// <summary>
+  /// when pipelined, wait for the pass in flight & make its vertices the ones drawn, the only sync point each frame
+  /// </summary>
+  void sync ()
+  {
+    if (!workers.is_dispatched ())
+    {
+      return;
+    }
+
+    PROFILE_ZONE ("sync");
+    Timer wait_timer;
+    wait_timer.start ();
+    workers.wait ();
+    wait_timer.stop ();
+    timings.wait_ms = wait_timer.get_elapsed_ms ();
+
+    // the pass started at dispatch, so its time is the slowest thread's, not the time since
+    timings.update_ms = 0.0f;
+    for (work_stealing_scheduler::thread_stats const& thread : scheduler.get_thread_stats ())
+    {
+      timings.update_ms = thread.busy_ms > timings.update_ms ? thread.busy_ms : timings.update_ms;
+    }
+
+    cull_vertices_into (back_renderer);
+    rasterise_vertices ();
+    std::swap (particle_renderer, back_renderer);
+    finish_update ();
+  }
+
+  /// <summary>
+  /// compact the vertices written by the pass that survive culling into a renderer's vertex array, see vertex_cull.h
+  /// each pass over the vertices is split evenly between the threads, the survivors keep their order
+  /// </summary>
+  void cull_vertices_into (particle_renderer_2d& target)
+  {
+    counts.num_vertices = counts.num_drawn = pass.max_vertices;
+    if (culler.get_mode () == vertex_cull_mode::none)
+    {
+      return;
+    }
+
+    PROFILE_ZONE ("cull");
+    Timer cull_timer;
+    cull_timer.start ();
+    culler.next_frame ();
+
+    sf::Vertex const* const vertices = pass.vertices;
+    unsigned const num_vertices = pass.max_vertices;
+    unsigned const num_threads = workers.size ();
+    auto const first_of = [num_vertices, num_threads] (unsigned thread_index)
+    {
+      return (unsigned)((unsigned long long)num_vertices * thread_index / num_threads);
+    };
+
+    if (culler.get_mode () == vertex_cull_mode::pixel)
+    {
+      auto claim_job = [this, vertices, &first_of] (unsigned thread_index)
+      {
+        culler.claim (vertices, first_of (thread_index), first_of (thread_index + 1u));
+      };
+      workers.run (claim_job);
+    }
+
+    auto count_job = [this, vertices, &first_of] (unsigned thread_index)
+    {
+      cull_offsets [thread_index] = culler.count (vertices, first_of (thread_index), first_of (thread_index + 1u));
+    };
+    workers.run (count_job);
+
+    // each thread's survivors go after every earlier thread's
+    unsigned num_drawn = 0u;
+    for (unsigned& offset : cull_offsets)
+    {
+      unsigned const num_kept = offset;
+      offset = num_drawn;
+      num_drawn += num_kept;
+    }
+
+    sf::Vertex* const out = target.reserve (num_drawn);
+    auto compact_job = [this, vertices, out, &first_of] (unsigned thread_index)
+    {
+      culler.compact (vertices, first_of (thread_index), first_of (thread_index + 1u), out + cull_offsets [thread_index]);
+    };
+    workers.run (compact_job);
+
+    counts.num_drawn = num_drawn;
+    cull_timer.stop ();
+    timings.cull_ms = cull_timer.get_elapsed_ms ();
+  }
+
+  /// <summary>
+  /// draw the vertices written by the pass into the software renderer's framebuffer, see software_renderer.h
+  /// counting & binning split the vertices evenly between the threads, the tiles are taken as each thread finishes one
+  /// </summary>
+  void rasterise_vertices ()
+  {
+    if (render_mode != particle_render_mode::software)
+    {
+      return;
+    }
+
+    PROFILE_ZONE ("rasterise");
+    Timer raster_timer;
+    raster_timer.start ();
+
+    sf::Vertex const* const vertices = pass.vertices;
+    unsigned const num_vertices = pass.max_vertices;
+    unsigned const num_threads = workers.size ();
+    auto const first_of = [num_vertices, num_threads] (unsigned thread_index)
+    {
+      return (unsigned)((unsigned long long)num_vertices * thread_index / num_threads);
+    };
+
+    auto count_job = [this, vertices, &first_of] (unsigned thread_index)
+    {
+      software_renderer.count (thread_index, vertices, first_of (thread_index), first_of (thread_index + 1u));
+    };
+    workers.run (count_job);
+
+    counts.num_drawn = software_renderer.place ();
+
+    auto bin_job = [this, vertices, &first_of] (unsigned thread_index)
+    {
+      software_renderer.bin (thread_index, vertices, first_of (thread_index), first_of (thread_index + 1u));
+    };
+    workers.run (bin_job);
+
+    auto draw_job = [this] (unsigned)
+    {
+      software_renderer.draw_tiles ();
+    };
+    workers.run (draw_job);
+
+    raster_timer.stop ();
+    timings.raster_ms = raster_timer.get_elapsed_ms ();
+  }
+
+  /// <summary>
+  /// counts & stats of the pass that just finished
+  /// </summary>
+  void finish_update ()
+  {
+    counts.num_particles = get_num_particles ();
+    counts.num_spawned = 0u;
+    for (particle_slice const& slice : particles)
+    {
+      counts.num_spawned += slice.num_spawned;
+    }
+    counts.num_killed = (unsigned)(pass_num_before + counts.num_spawned - counts.num_particles);
+    update_ms_total += timings.update_ms;
+    load_imbalance = scheduler.get_load_imbalance ();
+    chunks_stolen = scheduler.get_tasks_stolen ();
+    chunks_updated = (unsigned)tasks.size ();
+    finished_traffic = traffic; // the pass in flight (pipelined) keeps writing traffic
+    record_counters ();
+  }
+
+  static std::uint64_t const FNV_OFFSET = 0xcbf29ce484222325ull;
+
+  static std::uint64_t fnv1a (std::uint64_t hash, void const* data, size_t size)
+  {
+    unsigned char const* bytes = (unsigned char const*)data;
+    for (size_t i = 0u; i < size; ++i)
+    {
+      hash = (hash ^ bytes [i]) * 0x100000001b3ull;
+    }
+    return hash;
+  }
+
+  /// <summary>
+  /// set the frame's shared spawn budget & every slice's share of it, before emit
+  /// all slices' particles count against max_particles together, so room left by one slice's particles dying sooner
+  /// is used by the others instead of sitting idle, & every slice gets an equal share so the threads' work stays even
+  /// </summary>
+  void share_budget (float elapsed_seconds, long long num_particles)
+  {
+    unsigned long long wanted = 0u;
+    for (particle_slice& slice : particles)
+    {
+      wanted += slice.frame_spawns (elapsed_seconds);
+    }
+
+    // particles expiring this frame are not counted as free until the next frame
+    unsigned const room = num_particles < (long long)max_particles ? max_particles - (unsigned)num_particles : 0u;
+    unsigned const num_spawns = wanted < room ? (unsigned)wanted : room; // an exhausted budget shows in the occupancy
+
+    budget.reset (num_spawns);
+    unsigned const num_slices = (unsigned)particles.size ();
+    for (unsigned i = 0u; i < num_slices; ++i)
+    {
+      particles [i].budget_share = num_spawns / num_slices + (i < num_spawns % num_slices ? 1u : 0u);
+    }
+  }
+
+  /// <summary>
+  /// the last update's counts & each worker's busy time, as trace counters (see profiler.h)
+  /// </summary>
+  void record_counters ()
+  {
+    if (!trace_recorder::get ().is_recording ())
+    {
+      return;
+    }
+
+    profile_counter ("particles", "active", (double)counts.num_particles);
+    profile_counter ("particles per frame", "spawned", (double)counts.num_spawned);
+    profile_counter ("particles per frame", "killed", (double)counts.num_killed);
+    profile_counter ("phase ms", "emit", timings.emit_ms);
+    profile_counter ("phase ms", "update", timings.update_ms);
+    if (pipelined)
+    {
+      profile_counter ("phase ms", "wait", timings.wait_ms);
+    }
+    if (culler.get_mode () != vertex_cull_mode::none)
+    {
+      profile_counter ("phase ms", "cull", timings.cull_ms);
+      profile_counter ("vertices", "drawn", (double)counts.num_drawn);
+    }
+    if (render_mode == particle_render_mode::software)
+    {
+      profile_counter ("phase ms", "rasterise", timings.raster_ms);
+    }
+    std::vector <work_stealing_scheduler::thread_stats> const& stats = scheduler.get_thread_stats ();
+    for (size_t i = 0u; i < stats.size () && i < worker_series.size (); ++i)
+    {
+      profile_counter ("worker busy ms", worker_series [i], stats [i].busy_ms);
+    }
+  }
+
+  /// <summary>
+  /// list every chunk as a task, each thread starts with its own slice's chunks
+  /// </summary>
+  /// <returns>total number of vertices, each chunk's first_vertex is the total before it</returns>
+  unsigned build_tasks ()
+  {
+    tasks.clear ();
+    particle_update_function const update = analytic ? update_chunk_analytic : update_chunk;
+    unsigned num_vertices = 0u;
+    for (unsigned i = 0u; i < (unsigned)particles.size (); ++i)
+    {
+      unsigned const first_task = (unsigned)tasks.size ();
+      for (unsigned type = 0u; type < (unsigned)types.size (); ++type)
+      {
+        for (particle_pool& chunk : particles [i].chunks [type])
+        {
+          tasks.push_back ({ &chunk, &types [type], update, num_vertices });
+          num_vertices += chunk.num_live () + chunk.spawn_quota;
+        }
+      }
+      scheduler.assign (i, first_task, (unsigned)tasks.size ());
+    }
+    return num_vertices;
+  }
+
   particle_renderer_2d particle_renderer;
-  std::vector <particle*> particles[numThreads];
+  particle_renderer_2d back_renderer; // pipelined only, written by the pass in flight while particle_renderer is drawn
+  std::vector <particle_type_desc> types; // see particle_types.h
+  std::vector <particle_slice> particles; // one slice per worker thread
+  std::vector <particle_task> tasks;      // every chunk, rebuilt each update
+  particle_arena arena;
+  unsigned max_particles = PARTICLE_MAX; // see SHOT2_MAX_PARTICLES in config.h
+  particle_budget budget;      // this frame's spawns, shared by every slice when shared_budget
+  bool shared_budget = false;
+  unsigned heap_allocations = 0u;
+  thread_pool workers;
+  work_stealing_scheduler scheduler;
+  phase_timings timings;
+  frame_counts counts;
+  std::vector <char const*> worker_series; // counter series names, "worker N"
+  bool analytic = false; // update with update_chunk_analytic rather than update_chunk
+  bool pipelined = false; // see the top of this file
+  update_pass pass = {};
+  vertex_culler culler;                   // see vertex_cull.h
+  particle_render_mode render_mode = particle_render_mode::points;
+  software_renderer_2d software_renderer; // software mode only, see software_renderer.h
+  std::vector <sf::Vertex> scratch_vertices; // culling & software only, the pass's vertices before culling or rasterising
+  std::vector <unsigned> cull_offsets;    // culling only, where each thread's survivors go
+  long long pass_num_before = 0; // particles before the pass, for the killed count
+  float load_imbalance = 1.0f;
+
+  /// <summary>
+  /// one thread's share of the update passes so far, see get_node_traffic
+  /// </summary>
+  struct alignas (64) thread_traffic // own cache line, each is written by its own thread
+  {
+    unsigned long long particles = 0u;
+    unsigned long long local_chunks = 0u, remote_chunks = 0u;
+    unsigned node = 0u; // node the thread ran its last pass on
+  };
+
+  thread_placement placement;
+  std::vector <unsigned> slice_nodes;   // node each slice's chunks were touched on
+  std::vector <thread_traffic> traffic; // one per thread
+  std::vector <thread_traffic> finished_traffic; // traffic as of the last finished update, see get_node_traffic
+  double update_ms_total = 0.0;         // every update pass so far
+  unsigned chunks_stolen = 0u, chunks_updated = 0u;
+  double clock = 0.0;    // seconds since initialise, for analytic mode
 };
@@ -0,0 +1,424 @@
+// HOW IT WORKS:
+//
+// Particle type (emitter) definitions.
+// Every particle type is described at run time by a particle_type_desc: where its particles spawn,
+// how fast they move, their acceleration, kill_y, life time range & start/end colours.
+// The particle system updates each chunk with the same loop for every type,
+// with the chunk's type constants loaded into locals once per chunk, so a type read from a file costs no more per particle
+// than one written in code.
+//
+// By default the 3 original types are used (default_particle_types).
+// Set SHOT2_EMITTERS to the path of an INI file to use its types instead, up to MAX_PARTICLE_TYPES of them,
+// see 'emitters.ini' for the original types written out as an example. Each [section] is a type:
+//
+//   [name]
+//   life         = min, max        seconds the particle lives for                  (required, min > 0, max < 1024)
+//   position_x   = min, max        spawn position                                  (default: 0)
+//   position_y   = min, max
+//   velocity_x   = min, max        spawn velocity, per second                      (default: 0)
+//   velocity_y   = min, max
+//   acceleration = x, y            velocity change, per second                     (default: 0, 0)
+//   kill_y       = y               the particle is destroyed below this            (default: bottom of the screen)
+//   start_colour = r, g, b, a      colour at spawn, each 0 - 1 (clamped)           (default: white)
+//   end_colour   = r, g, b, a      colour at the end of its life                   (default: white)
+//   share        = weight          share of each frame's spawns, relative to other types (default: 1)
+//
+// A range given as a single value is fixed. ';' or '#' starts a comment, to the end of the line.
+// If the file cannot be read or has an error, the error is printed & the default types are used.
+
+
+
+#pragma once
+
+#include "constants.h"
+#include "extra/particle_renderer_2d.h"
+
+#include "magpie.h"
+
+#include <algorithm> // for std::min
+#include <cstdlib>   // for std::strtof
+#include <cstring>   // for std::strncpy, std::strcmp
+#include <fstream>   // for std::ifstream
+#include <string>
+#include <vector>
+
+// UTILITY
+
+/// <summary>
+/// period of the clock analytic particles are timed by
+/// the clock wraps rather than growing, so spawn times keep their precision however long the game runs
+/// (a float below 1024 is accurate to ~0.1ms), a particle must not live longer than a period
+/// </summary>
+static float const PARTICLE_CLOCK_PERIOD = 1024.0f;
+
+struct vector4
+{
+    float x;
+    float y;
+};
+
+struct colourf
+{
+  float r;
+  float g;
+  float b;
+  float a;
+};
+
+/// <summary>
+/// linearly interpolate value between v0 and v1 based on the 0.0 - 1.0 value of t
+/// </summary>
+/// <param name="v0">start value</param>
+/// <param name="v1">end value</param>
+/// <param name="t">lerp proportion</param>
+/// <returns>interpolated value</returns>
+static float lerp (float v0, float v1, float t)
+{
+  return ((1.0f - t) * v0) + (t * v1);
+}
+
+
+// PARTICLE TYPES
+
+/// <summary>
+/// most particle types the particle system can run at once
+/// </summary>
+static unsigned const MAX_PARTICLE_TYPES = 16u;
+
+/// <summary>
+/// number of entries in each type's colour table, one per 8 bit life ratio
+/// </summary>
+static unsigned const PARTICLE_COLOUR_STEPS = 256u;
+
+/// <summary>
+/// ranges a particle type's spawn values are drawn from, each uniform in [min, max), or exactly min when min == max
+/// </summary>
+struct particle_spawn_ranges
+{
+  float life_min, life_max;
+  float position_x_min, position_x_max;
+  float position_y_min, position_y_max;
+  float velocity_x_min, velocity_x_max;
+  float velocity_y_min, velocity_y_max;
+};
+
+/// <summary>
+/// everything that makes one particle type different from another
+/// </summary>
+struct particle_type_desc
+{
+  char name [32] = {};
+
+  particle_spawn_ranges spawn = {};
+  vector4 acceleration = { 0.0f, 0.0f };
+  float kill_y = -(float)SCREEN_HEIGHT / 2.0f;
+
+  colourf start_colour = { 1.0f, 1.0f, 1.0f, 1.0f };
+  colourf end_colour = { 1.0f, 1.0f, 1.0f, 1.0f };
+
+  float share = 1.0f; // share of each frame's spawns, relative to the other types
+
+  /// <summary>
+  /// particle colour is derived from its type and the ratio between life_remaining & life_time,
+  /// so it is calculated when needed rather than stored per particle
+  /// </summary>
+  /// <param name="life_remaining">particle's remaining life</param>
+  /// <param name="inv_life_time">1 / particle's total life</param>
+  /// <returns>particle's current colour</returns>
+  colourf colour (float life_remaining, float inv_life_time) const
+  {
+    float const t = life_remaining * inv_life_time;
+    return { lerp (end_colour.r, start_colour.r, t),
+      lerp (end_colour.g, start_colour.g, t),
+      lerp (end_colour.b, start_colour.b, t),
+      lerp (end_colour.a, start_colour.a, t) };
+  }
+
+  /// <summary>
+  /// fill in colours from start_colour & end_colour, once the type is complete
+  /// </summary>
+  void build_colour_table ()
+  {
+    for (unsigned i = 0u; i < PARTICLE_COLOUR_STEPS; ++i)
+    {
+      colourf const c = colour ((float)i, 1.0f / (float)(PARTICLE_COLOUR_STEPS - 1u));
+      colours [i] = particle_renderer_2d::make_vertex (0.0f, 0.0f, c.r, c.g, c.b, c.a).color;
+    }
+  }
+
+  // the type's colour for every quantised life ratio, already converted to RGBA8 as particle_renderer_2d::draw would
+  // entry i is the colour at a life ratio of i / (PARTICLE_COLOUR_STEPS - 1), see particle_colour_index
+  sf::Color colours [PARTICLE_COLOUR_STEPS];
+};
+
+/// <summary>
+/// index into a colour table, the life ratio rounded to the nearest step
+/// </summary>
+static unsigned particle_colour_index (float life_remaining, float inv_life_time)
+{
+  float const step = life_remaining * inv_life_time * (float)(PARTICLE_COLOUR_STEPS - 1u) + 0.5f;
+  return step <= 0.0f ? 0u : step >= (float)(PARTICLE_COLOUR_STEPS - 1u) ? PARTICLE_COLOUR_STEPS - 1u : (unsigned)step;
+}
+
+/// <summary>
+/// the 3 original particle types
+/// </summary>
+static std::vector <particle_type_desc> default_particle_types ()
+{
+  std::vector <particle_type_desc> types (NUM_PARTICLE_TYPES);
+
+  // left hand side of screen
+  particle_type_desc& a = types [0];
+  std::strncpy (a.name, "a", sizeof (a.name) - 1u);
+  a.spawn =
+  {
+    7.5f, 13.0f,
+    -(float)SCREEN_WIDTH / 2.0f, -(float)SCREEN_WIDTH / 2.0f + 200.0f,
+    -(float)SCREEN_HEIGHT / 2.0f, -(float)SCREEN_HEIGHT / 2.0f + 100.0f,
+    magpie::maths::cos (magpie::maths::radians (89.0f)) * 200.f, magpie::maths::cos (magpie::maths::radians (75.0f)) * 200.f,
+    magpie::maths::sin (magpie::maths::radians (75.0f)) * 200.f, magpie::maths::sin (magpie::maths::radians (89.0f)) * 200.f,
+  };
+  a.acceleration = { 2.0f, -26.5f };
+  a.kill_y = -(float)SCREEN_HEIGHT / 2.0f;
+  a.start_colour = { 1.0f, 0.2f, 0.2f, 1.0f }; // red
+  a.end_colour = { 0.2f, 1.0f, 1.0f, 1.0f }; // inverse red
+
+  // middle of screen
+  particle_type_desc& b = types [1];
+  std::strncpy (b.name, "b", sizeof (b.name) - 1u);
+  b.spawn =
+  {
+    9.0f, 10.0f,
+    0.0f, (float)SCREEN_WIDTH / 3.0f,
+    (float)SCREEN_HEIGHT / 2.0f, (float)SCREEN_HEIGHT / 2.0f,
+    -50.0f, -50.0f,
+    -100.0f, -60.0f,
+  };
+  b.acceleration = { 0.0f, 0.0f };
+  b.kill_y = -(float)SCREEN_HEIGHT / 2.0f + 50.0f;
+  b.start_colour = { 0.2f, 1.0f, 0.2f, 1.0f }; // green
+  b.end_colour = { 1.0f, 0.2f, 1.0f, 1.0f }; // inverse green
+
+  // right hand side of screen
+  particle_type_desc& c = types [2];
+  std::strncpy (c.name, "c", sizeof (c.name) - 1u);
+  c.spawn =
+  {
+    3.5f, 6.0f,
+    (float)SCREEN_WIDTH / 2.0f - 300.0f, (float)SCREEN_WIDTH / 2.0f - 300.0f,
+    -(float)SCREEN_HEIGHT / 2.0f + 400.0f, -(float)SCREEN_HEIGHT / 2.0f + 400.0f,
+    -50.0f, 50.0f,
+    -50.0f, 50.0f,
+  };
+  c.acceleration = { 0.0f, 0.0f };
+  c.kill_y = -(float)SCREEN_HEIGHT / 2.0f + 15.0f;
+  c.start_colour = { 0.2f, 0.2f, 1.0f, 1.0f }; // blue
+  c.end_colour = { 1.0f, 1.0f, 0.2f, 1.0f }; // inverse blue
+
+  for (particle_type_desc& type : types)
+  {
+    type.build_colour_table ();
+  }
+  return types;
+}
+
+/// <summary>
+/// parse a comma separated list of exactly count floats
+/// </summary>
+static bool parse_floats (char const* text, float* values, unsigned count)
+{
+  for (unsigned i = 0u; i < count; ++i)
+  {
+    char* end = nullptr;
+    values [i] = std::strtof (text, &end);
+    if (end == text)
+    {
+      return false;
+    }
+    text = end;
+    while (*text == ' ' || *text == '\t')
+    {
+      text++;
+    }
+    if (i + 1u < count)
+    {
+      if (*text != ',')
+      {
+        return false;
+      }
+      text++;
+    }
+  }
+  return *text == '\0';
+}
+
+/// <summary>
+/// parse a range, a single value is a fixed range
+/// </summary>
+static bool parse_range (char const* text, float& min, float& max)
+{
+  float values [2];
+  if (parse_floats (text, values, 2u))
+  {
+    min = values [0];
+    max = values [1];
+    return min <= max;
+  }
+  if (parse_floats (text, values, 1u))
+  {
+    min = max = values [0];
+    return true;
+  }
+  return false;
+}
+
+/// <summary>
+/// a colour with every channel kept to 0 - 1, as converting to 8 bits would wrap anything outside it
+/// </summary>
+static colourf clamp_colour (float const (&values) [4], char const* path, unsigned line_number)
+{
+  float clamped [4];
+  for (unsigned i = 0u; i < 4u; ++i)
+  {
+    clamped [i] = !(values [i] > 0.0f) ? 0.0f : values [i] < 1.0f ? values [i] : 1.0f; // NaN becomes 0
+  }
+  if (clamped [0] != values [0] || clamped [1] != values [1] || clamped [2] != values [2] || clamped [3] != values [3])
+  {
+    magpie::printf ("particle types: '%s' line %u, colour clamped to 0 - 1\n", path, line_number);
+  }
+  return { clamped [0], clamped [1], clamped [2], clamped [3] };
+}
+
+/// <summary>
+/// read particle types from an INI file, see the top of this file for the format
+/// </summary>
+/// <param name="path">file to read</param>
+/// <param name="types">replaced by the file's types, only if the whole file is valid</param>
+/// <returns>true, if the file was read</returns>
+static bool load_particle_types (char const* path, std::vector <particle_type_desc>& types)
+{
+  std::ifstream file (path);
+  if (!file)
+  {
+    magpie::printf ("particle types: could not open '%s'\n", path);
+    return false;
+  }
+
+  std::vector <particle_type_desc> loaded;
+  std::vector <bool> has_life;
+  std::string line;
+  unsigned line_number = 0u;
+  while (std::getline (file, line))
+  {
+    ++line_number;
+
+    // strip comments & whitespace, skip blank lines
+    line = line.substr (0u, line.find_first_of (";#"));
+    size_t const first = line.find_first_not_of (" \t\r");
+    if (first == std::string::npos)
+    {
+      continue;
+    }
+    line = line.substr (first, line.find_last_not_of (" \t\r") + 1u - first);
+
+    if (line.front () == '[')
+    {
+      if (line.back () != ']' || line.size () < 3u || loaded.size () == MAX_PARTICLE_TYPES)
+      {
+        magpie::printf ("particle types: '%s' line %u, bad section or more than %u types\n", path, line_number, MAX_PARTICLE_TYPES);
+        return false;
+      }
+      loaded.emplace_back ();
+      has_life.push_back (false);
+      std::strncpy (loaded.back ().name, line.c_str () + 1, std::min (line.size () - 2u, sizeof (loaded.back ().name) - 1u));
+      continue;
+    }
+
+    size_t const equals = line.find ('=');
+    if (loaded.empty () || equals == std::string::npos)
+    {
+      magpie::printf ("particle types: '%s' line %u, expected 'key = value' inside a [section]\n", path, line_number);
+      return false;
+    }
+    std::string const key = line.substr (0u, line.find_last_not_of (" \t", equals - 1u) + 1u);
+    size_t const value_start = line.find_first_not_of (" \t", equals + 1u);
+    std::string const value = value_start == std::string::npos ? std::string () : line.substr (value_start);
+
+    particle_type_desc& type = loaded.back ();
+    float values [4];
+    bool valid = false;
+    if (key == "life")
+    {
+      valid = parse_range (value.c_str (), type.spawn.life_min, type.spawn.life_max) && type.spawn.life_min > 0.0f;
+      if (valid && type.spawn.life_max >= PARTICLE_CLOCK_PERIOD)
+      {
+        // analytic mode could not tell how old the particle is, see PARTICLE_CLOCK_PERIOD
+        magpie::printf ("particle types: '%s' line %u, life must be less than %.0f seconds\n", path, line_number, PARTICLE_CLOCK_PERIOD);
+        return false;
+      }
+      has_life.back () = valid;
+    }
+    else if (key == "position_x")
+      valid = parse_range (value.c_str (), type.spawn.position_x_min, type.spawn.position_x_max);
+    else if (key == "position_y")
+      valid = parse_range (value.c_str (), type.spawn.position_y_min, type.spawn.position_y_max);
+    else if (key == "velocity_x")
+      valid = parse_range (value.c_str (), type.spawn.velocity_x_min, type.spawn.velocity_x_max);
+    else if (key == "velocity_y")
+      valid = parse_range (value.c_str (), type.spawn.velocity_y_min, type.spawn.velocity_y_max);
+    else if (key == "acceleration" && (valid = parse_floats (value.c_str (), values, 2u)))
+      type.acceleration = { values [0], values [1] };
+    else if (key == "kill_y")
+      valid = parse_floats (value.c_str (), &type.kill_y, 1u);
+    else if (key == "start_colour" && (valid = parse_floats (value.c_str (), values, 4u)))
+      type.start_colour = clamp_colour (values, path, line_number);
+    else if (key == "end_colour" && (valid = parse_floats (value.c_str (), values, 4u)))
+      type.end_colour = clamp_colour (values, path, line_number);
+    else if (key == "share")
+      valid = parse_floats (value.c_str (), &type.share, 1u) && type.share >= 0.0f;
+
+    if (!valid)
+    {
+      magpie::printf ("particle types: '%s' line %u, bad or unknown value for '%s'\n", path, line_number, key.c_str ());
+      return false;
+    }
+  }
+
+  if (loaded.empty ())
+  {
+    magpie::printf ("particle types: '%s' has no types\n", path);
+    return false;
+  }
+  float total_share = 0.0f;
+  for (size_t i = 0u; i < loaded.size (); ++i)
+  {
+    total_share += loaded [i].share;
+    if (!has_life [i])
+    {
+      magpie::printf ("particle types: '%s' type '%s' has no life\n", path, loaded [i].name);
+      return false;
+    }
+    loaded [i].build_colour_table ();
+  }
+  if (total_share <= 0.0f)
+  {
+    magpie::printf ("particle types: '%s' every type has a share of 0\n", path);
+    return false;
+  }
+
+  types = std::move (loaded);
+  return true;
+}
+
+/// <summary>
+/// the particle types to run, from the file at path if there is one, otherwise the defaults
+/// </summary>
+static std::vector <particle_type_desc> particle_types_from_file (char const* path)
+{
+  std::vector <particle_type_desc> types = default_particle_types ();
+  if (path && !load_particle_types (path, types))
+  {
+    magpie::printf ("particle types: using the default types\n");
+  }
+  return types;
+}
@@ -0,0 +1,307 @@
+// HOW IT WORKS:
+//
+// Scoped instrumentation of the hot path, recorded to a Chrome trace (open it in chrome://tracing or ui.perfetto.dev).
+// Set SHOT2_TRACE to a file path (see config.h) & every PROFILE_ZONE is recorded with its start & duration on its thread,
+// along with per frame counters (active particles, spawned, killed & each worker's busy time),
+// and the trace is written as JSON when the particle system is released.
+//
+// Each thread records into its own buffer, allocated the first time it records, so recording takes no lock & no allocation.
+// A buffer holds up to SHOT2_TRACE_EVENTS events (default 1 << 18), after that the thread's events are dropped & counted.
+// When nothing is being recorded a zone costs a single load of the recording flag.
+//
+// With Optick enabled (ENABLE_OPTICK in CMake, which defines MAGPIE_OPTICK for every project, see CMakeLists.txt)
+// the zones, frames & threads are also Optick events, so the same instrumentation can be captured live with the Optick GUI.
+//
+//   PROFILE_FRAME (name)         - start of a frame on the main thread
+//   PROFILE_THREAD (name, index) - name the calling thread, once, where it starts
+//   PROFILE_ZONE (name)          - time the rest of the enclosing scope, name must be a string literal
+//   profile_counter (name, series, value) - a counter value, series must be a string literal or interned with profile_intern
+
+
+
+#pragma once
+
+#include "magpie.h"
+
+#if defined (MAGPIE_OPTICK)
+#include "optick.h"
+#endif // MAGPIE_OPTICK
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>   // for std::snprintf
+#include <cstring>  // for std::strcmp
+#include <deque>
+#include <fstream>  // for std::ofstream
+#include <memory>   // for std::unique_ptr
+#include <mutex>
+#include <string>
+#include <vector>
+
+
+/// <summary>
+/// a zone ('X') or counter ('C') event
+/// </summary>
+struct trace_event
+{
+  char const* name;
+  char const* series;   // counters only
+  long long start_ns;   // since recording started
+  long long duration_ns; // zones only
+  double value;          // counters only
+  char phase;
+};
+
+/// <summary>
+/// one thread's events
+/// </summary>
+struct trace_buffer
+{
+  std::vector <trace_event> events;
+  char const* thread_name = "thread";
+  unsigned thread_index = 0u;
+  unsigned thread_id = 0u; // order the thread first recorded in, the trace's tid
+  unsigned dropped = 0u;
+};
+
+class trace_recorder
+{
+public:
+  static trace_recorder& get ()
+  {
+    static trace_recorder recorder;
+    return recorder;
+  }
+
+  /// <summary>
+  /// start recording, called before any worker records
+  /// </summary>
+  /// <param name="path">where the trace is written by stop</param>
+  /// <param name="max_events">events each thread can record</param>
+  void start (char const* path, unsigned max_events)
+  {
+    this->path = path;
+    this->max_events = max_events;
+    epoch = std::chrono::steady_clock::now ();
+    recording.store (true, std::memory_order_release);
+    magpie::printf ("trace: recording to '%s'\n", path);
+  }
+
+  bool is_recording () const
+  {
+    return recording.load (std::memory_order_relaxed);
+  }
+
+  /// <returns>nanoseconds since recording started</returns>
+  long long now () const
+  {
+    return std::chrono::duration_cast <std::chrono::nanoseconds> (std::chrono::steady_clock::now () - epoch).count ();
+  }
+
+  /// <summary>
+  /// name the calling thread, its buffer takes the name when it is made
+  /// </summary>
+  void name_thread (char const* name, unsigned index)
+  {
+    thread_state& state = this_thread ();
+    state.name = name;
+    state.index = index;
+    if (state.buffer)
+    {
+      state.buffer->thread_name = name;
+      state.buffer->thread_index = index;
+    }
+  }
+
+  void add_zone (char const* name, long long start_ns, long long end_ns)
+  {
+    add ({ name, nullptr, start_ns, end_ns - start_ns, 0.0, 'X' });
+  }
+
+  void add_counter (char const* name, char const* series, double value)
+  {
+    add ({ name, series, now (), 0, value, 'C' });
+  }
+
+  /// <summary>
+  /// a copy of text that lives until the program ends, for names made at run time
+  /// </summary>
+  char const* intern (std::string const& text)
+  {
+    std::lock_guard <std::mutex> lock (mutex);
+    interned.push_back (text);
+    return interned.back ().c_str ();
+  }
+
+  /// <summary>
+  /// stop recording & write the trace, called once no other thread is recording
+  /// </summary>
+  void stop ()
+  {
+    if (!recording.exchange (false))
+    {
+      return;
+    }
+
+    std::ofstream file (path);
+    if (!file)
+    {
+      magpie::printf ("trace: could not write '%s'\n", path);
+      return;
+    }
+
+    std::lock_guard <std::mutex> lock (mutex);
+    size_t num_events = 0u;
+    unsigned num_dropped = 0u;
+    char line [512];
+    file << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n";
+    bool first = true;
+    for (std::unique_ptr <trace_buffer> const& buffer : buffers)
+    {
+      std::snprintf (line, sizeof (line), "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s %u\"}}",
+        first ? "" : ",\n", buffer->thread_id, buffer->thread_name, buffer->thread_index);
+      file << line;
+      first = false;
+
+      // counters recorded one after another under the same name are one event with a value per series
+      std::vector <trace_event> const& events = buffer->events;
+      for (size_t i = 0u; i < events.size (); ++i)
+      {
+        trace_event const& event = events [i];
+        if (event.phase == 'X')
+        {
+          std::snprintf (line, sizeof (line), ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+            event.name, buffer->thread_id, (double)event.start_ns / 1000.0, (double)event.duration_ns / 1000.0);
+          file << line;
+          continue;
+        }
+
+        std::snprintf (line, sizeof (line), ",\n{\"name\":\"%s\",\"ph\":\"C\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"args\":{\"%s\":%g",
+          event.name, buffer->thread_id, (double)event.start_ns / 1000.0, event.series, event.value);
+        file << line;
+        while (i + 1u < events.size () && events [i + 1u].phase == 'C' && std::strcmp (events [i + 1u].name, event.name) == 0)
+        {
+          ++i;
+          std::snprintf (line, sizeof (line), ",\"%s\":%g", events [i].series, events [i].value);
+          file << line;
+        }
+        file << "}}";
+      }
+      num_events += events.size ();
+      num_dropped += buffer->dropped;
+    }
+    file << "\n]}\n";
+
+    magpie::printf ("trace: wrote %llu events to '%s'", (unsigned long long)num_events, path);
+    magpie::printf (num_dropped > 0u ? ", %u dropped (raise SHOT2_TRACE_EVENTS)\n" : "\n", num_dropped);
+  }
+
+private:
+  struct thread_state
+  {
+    trace_buffer* buffer = nullptr;
+    char const* name = "thread";
+    unsigned index = 0u;
+  };
+
+  static thread_state& this_thread ()
+  {
+    thread_local thread_state state;
+    return state;
+  }
+
+  void add (trace_event const& event)
+  {
+    thread_state& state = this_thread ();
+    if (!state.buffer)
+    {
+      // first event on this thread, the only time recording takes the lock
+      std::lock_guard <std::mutex> lock (mutex);
+      buffers.emplace_back (new trace_buffer);
+      state.buffer = buffers.back ().get ();
+      state.buffer->events.reserve (max_events);
+      state.buffer->thread_name = state.name;
+      state.buffer->thread_index = state.index;
+      state.buffer->thread_id = (unsigned)buffers.size ();
+    }
+
+    trace_buffer& buffer = *state.buffer;
+    if (buffer.events.size () < max_events)
+    {
+      buffer.events.push_back (event);
+    }
+    else
+    {
+      buffer.dropped++;
+    }
+  }
+
+  std::atomic <bool> recording = { false };
+  std::chrono::steady_clock::time_point epoch;
+  char const* path = nullptr;
+  unsigned max_events = 0u;
+
+  std::mutex mutex; // guards buffers & interned
+  std::vector <std::unique_ptr <trace_buffer>> buffers;
+  std::deque <std::string> interned;
+};
+
+/// <summary>
+/// records the time from construction to destruction as a zone, see PROFILE_ZONE
+/// </summary>
+class profile_zone
+{
+public:
+  explicit profile_zone (char const* name)
+    : name (name), start_ns (trace_recorder::get ().is_recording () ? trace_recorder::get ().now () : -1)
+  {
+  }
+
+  ~profile_zone ()
+  {
+    if (start_ns >= 0)
+    {
+      trace_recorder::get ().add_zone (name, start_ns, trace_recorder::get ().now ());
+    }
+  }
+
+  profile_zone (profile_zone const&) = delete;
+  profile_zone& operator= (profile_zone const&) = delete;
+
+private:
+  char const* name;
+  long long start_ns;
+};
+
+/// <summary>
+/// record a counter value, if recording
+/// </summary>
+static void profile_counter (char const* name, char const* series, double value)
+{
+  trace_recorder& recorder = trace_recorder::get ();
+  if (recorder.is_recording ())
+  {
+    recorder.add_counter (name, series, value);
+  }
+}
+
+/// <summary>
+/// text that lives until the program ends, for counter series made at run time
+/// </summary>
+static char const* profile_intern (std::string const& text)
+{
+  return trace_recorder::get ().intern (text);
+}
+
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER (a, b)
+
+#if defined (MAGPIE_OPTICK)
+#define PROFILE_FRAME(name) OPTICK_FRAME (name)
+#define PROFILE_THREAD(name, index) OPTICK_THREAD (name); trace_recorder::get ().name_thread (name, index)
+#define PROFILE_ZONE(name) OPTICK_EVENT (name); profile_zone const PROFILE_CONCAT (profile_zone_, __LINE__) (name)
+#else // MAGPIE_OPTICK
+#define PROFILE_FRAME(name) ((void)0)
+#define PROFILE_THREAD(name, index) trace_recorder::get ().name_thread (name, index)
+#define PROFILE_ZONE(name) profile_zone const PROFILE_CONCAT (profile_zone_, __LINE__) (name)
+#endif // MAGPIE_OPTICK
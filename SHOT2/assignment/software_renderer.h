@@ -0,0 +1,338 @@
+// HOW IT WORKS:
+//
+// A CPU alternative to particle_renderer_2d (SHOT2_RENDERER=software, see config.h): instead of handing SFML up to 2M
+// 20 byte point vertices every frame, the particles are drawn into an RGBA8 framebuffer on the worker threads,
+// which is uploaded as one SCREEN_WIDTH x SCREEN_HEIGHT texture (6 MB) & drawn as a single sprite (flipped to fit Magpie's view),
+// or in headless mode written to '<SHOT2_FRAME_DUMP>.ppm' at the end of the run.
+//
+// Each particle is a single pixel, the one vertex_cull.h maps it to: Magpie's origin is the centre of the screen with +y up,
+// so a point at (x, y) covers column floor (x + SCREEN_WIDTH / 2) & row floor (SCREEN_HEIGHT / 2 - y), counted from the top left.
+// The screen is split into TILE_SIZE x TILE_SIZE tiles & a frame is drawn in 3 steps, each split between the worker threads:
+//   count - each thread counts how many of its share of the vertices land in each tile
+//   bin   - after a prefix sum (tile by tile, then thread by thread), each thread writes its vertices as 8 byte splats
+//           (pixel index & colour) into its own range of each tile's bin
+//   draw  - each thread takes tiles until none are left, clears the tile & draws its bin in order
+// A tile is only ever written by one thread & its bin holds its splats in vertex order,
+// so no locks or atomics are needed on the framebuffer & the last vertex on a pixel is the one on top, as with the points.
+//
+// Colours are blended as SFML's default BlendAlpha blends the points: opaque colours (every built in type) simply replace
+// the pixel, so the picture is pixel identical; translucent ones are blended in draw order, rounded as an 8 bit GPU would.
+
+
+
+#pragma once
+
+#include "constants.h"
+#include "vertex_cull.h"
+
+#include "magpie.h"
+
+#include <algorithm> // for std::fill
+#include <atomic>
+#include <cmath>    // for std::floor
+#include <cstdint>
+#include <cstdio>   // for std::fopen
+#include <cstring>  // for std::strcmp
+#include <string>
+#include <vector>
+
+
+/// <summary>
+/// which renderer draws the particles, see the top of this file
+/// </summary>
+enum class particle_render_mode
+{
+  points,   // particle_renderer_2d, a point list drawn by SFML
+  software, // software_renderer_2d
+};
+
+static char const* particle_render_mode_name (particle_render_mode mode)
+{
+  return mode == particle_render_mode::software ? "software" : "points";
+}
+
+/// <returns>the mode named by text ("software" or "points"), points for anything else</returns>
+static particle_render_mode particle_render_mode_from_name (char const* text)
+{
+  return std::strcmp (text, "software") == 0 ? particle_render_mode::software : particle_render_mode::points;
+}
+
+/// <returns>src drawn over dst with SFML's BlendAlpha (colour: src * a + dst * (1 - a), alpha: src + dst * (1 - a))</returns>
+static sf::Color blend_alpha (sf::Color src, sf::Color dst)
+{
+  if (src.a == 255u)
+  {
+    return src;
+  }
+  unsigned const a = src.a, inverse_a = 255u - src.a;
+  return sf::Color ((sf::Uint8)((src.r * a + dst.r * inverse_a + 127u) / 255u),
+    (sf::Uint8)((src.g * a + dst.g * inverse_a + 127u) / 255u),
+    (sf::Uint8)((src.b * a + dst.b * inverse_a + 127u) / 255u),
+    (sf::Uint8)((src.a * 255u + dst.a * inverse_a + 127u) / 255u));
+}
+
+/// <summary>
+/// the pixel a point at a world position lights, worked out without vertex_cull.h so it can check the tiles:
+/// Magpie's view has the origin at the centre of the screen & +y up, row 0 is the top of the screen
+/// </summary>
+/// <returns>false, if the point is off screen (or NaN)</returns>
+static bool point_pixel (float x, float y, unsigned& column, unsigned& row)
+{
+  float const screen_x = std::floor (x + (float)SCREEN_WIDTH * 0.5f), screen_y = std::floor ((float)SCREEN_HEIGHT * 0.5f - y);
+  if (!(screen_x >= 0.0f && screen_x <= (float)(SCREEN_WIDTH - 1u) && screen_y >= 0.0f && screen_y <= (float)(SCREEN_HEIGHT - 1u)))
+  {
+    return false;
+  }
+  column = (unsigned)screen_x;
+  row = (unsigned)screen_y;
+  return true;
+}
+
+/// <summary>
+/// draw vertices as points into a framebuffer one at a time, in order, what the tiled steps must match (e.g. to check them)
+/// </summary>
+/// <param name="framebuffer">SCREEN_WIDTH * SCREEN_HEIGHT pixels, row by row from the top left, drawn over</param>
+static void splat_points (sf::Vertex const* vertices, size_t count, sf::Color* framebuffer)
+{
+  for (size_t i = 0u; i < count; ++i)
+  {
+    unsigned column, row;
+    if (point_pixel (vertices [i].position.x, vertices [i].position.y, column, row))
+    {
+      sf::Color& pixel = framebuffer [row * SCREEN_WIDTH + column];
+      pixel = blend_alpha (vertices [i].color, pixel);
+    }
+  }
+}
+
+class software_renderer_2d
+{
+public:
+  static unsigned const TILE_SIZE = 64u;
+  static unsigned const TILES_X = (SCREEN_WIDTH + TILE_SIZE - 1u) / TILE_SIZE;
+  static unsigned const TILES_Y = (SCREEN_HEIGHT + TILE_SIZE - 1u) / TILE_SIZE;
+  static unsigned const NUM_TILES = TILES_X * TILES_Y;
+
+  static_assert (sizeof (sf::Color) == 4u, "the framebuffer is uploaded as RGBA8");
+
+  /// <summary>
+  /// allocate the framebuffer & bins
+  /// </summary>
+  /// <param name="num_threads">threads that will share each step</param>
+  /// <param name="max_vertices">most vertices drawn in a frame</param>
+  /// <param name="clear_colour">every pixel no particle covers, the colour the window is cleared to</param>
+  bool initialise (unsigned num_threads, unsigned max_vertices, sf::Color clear_colour)
+  {
+    this->num_threads = num_threads;
+    this->clear_colour = clear_colour;
+    framebuffer.assign ((size_t)SCREEN_WIDTH * SCREEN_HEIGHT, clear_colour);
+    splats.resize (max_vertices);
+    bin_offsets.assign ((size_t)num_threads * NUM_TILES, 0u);
+    tile_starts.assign (NUM_TILES + 1u, 0u);
+
+    // the framebuffer's row 0 is the top of the screen, Magpie's view is centred with +y up:
+    // put the texture's top left at the screen's top left & flip it so its rows run down the screen
+    sprite.setPosition (-(float)SCREEN_WIDTH * 0.5f, (float)SCREEN_HEIGHT * 0.5f);
+    sprite.setScale (1.0f, -1.0f);
+    return true;
+  }
+
+  /// <summary>
+  /// create the texture the framebuffer is uploaded to, needs a window (not headless), after initialise
+  /// </summary>
+  bool initialise_texture ()
+  {
+    if (!texture.create (SCREEN_WIDTH, SCREEN_HEIGHT))
+    {
+      return false;
+    }
+    sprite.setTexture (texture, true);
+    has_texture = true;
+    return true;
+  }
+
+  /// <summary>
+  /// count step, thread_index's share of the vertices is [first, end)
+  /// </summary>
+  void count (unsigned thread_index, sf::Vertex const* vertices, unsigned first, unsigned end)
+  {
+    unsigned* const bins = bin_offsets.data () + (size_t)thread_index * NUM_TILES;
+    for (unsigned tile = 0u; tile < NUM_TILES; ++tile)
+    {
+      bins [tile] = 0u;
+    }
+    for (unsigned i = first; i < end; ++i)
+    {
+      unsigned pixel;
+      if (pixel_of (vertices [i], pixel))
+      {
+        bins [tile_of (pixel)]++;
+      }
+    }
+  }
+
+  /// <summary>
+  /// turn every thread's counts into where its splats go in each tile's bin, on one thread between count & bin
+  /// </summary>
+  /// <returns>number of splats this frame</returns>
+  unsigned place ()
+  {
+    unsigned num_splats = 0u;
+    for (unsigned tile = 0u; tile < NUM_TILES; ++tile)
+    {
+      tile_starts [tile] = num_splats;
+      for (unsigned thread = 0u; thread < num_threads; ++thread)
+      {
+        unsigned& offset = bin_offsets [(size_t)thread * NUM_TILES + tile];
+        unsigned const num_binned = offset;
+        offset = num_splats;
+        num_splats += num_binned;
+      }
+    }
+    tile_starts [NUM_TILES] = num_splats;
+    next_tile.store (0u, std::memory_order_relaxed);
+    return num_splats;
+  }
+
+  /// <summary>
+  /// bin step, the same share of the vertices as count
+  /// </summary>
+  void bin (unsigned thread_index, sf::Vertex const* vertices, unsigned first, unsigned end)
+  {
+    unsigned* const bins = bin_offsets.data () + (size_t)thread_index * NUM_TILES;
+    splat* const out = splats.data ();
+    for (unsigned i = first; i < end; ++i)
+    {
+      unsigned pixel;
+      if (pixel_of (vertices [i], pixel))
+      {
+        out [bins [tile_of (pixel)]++] = { pixel, vertices [i].color };
+      }
+    }
+  }
+
+  /// <summary>
+  /// draw step, clear & draw tiles until there are none left
+  /// </summary>
+  void draw_tiles ()
+  {
+    for (unsigned tile = next_tile.fetch_add (1u, std::memory_order_relaxed); tile < NUM_TILES;
+      tile = next_tile.fetch_add (1u, std::memory_order_relaxed))
+    {
+      unsigned const x0 = (tile % TILES_X) * TILE_SIZE, y0 = (tile / TILES_X) * TILE_SIZE;
+      unsigned const x1 = x0 + TILE_SIZE < SCREEN_WIDTH ? x0 + TILE_SIZE : SCREEN_WIDTH;
+      unsigned const y1 = y0 + TILE_SIZE < SCREEN_HEIGHT ? y0 + TILE_SIZE : SCREEN_HEIGHT;
+      for (unsigned y = y0; y < y1; ++y)
+      {
+        std::fill (framebuffer.data () + y * SCREEN_WIDTH + x0, framebuffer.data () + y * SCREEN_WIDTH + x1, clear_colour);
+      }
+
+      sf::Color* const pixels = framebuffer.data ();
+      for (unsigned i = tile_starts [tile]; i < tile_starts [tile + 1u]; ++i)
+      {
+        sf::Color& pixel = pixels [splats [i].pixel];
+        pixel = blend_alpha (splats [i].colour, pixel);
+      }
+    }
+  }
+
+  /// <summary>
+  /// upload the framebuffer & draw it over the whole window
+  /// </summary>
+  void render (magpie::renderer& renderer)
+  {
+    if (!has_texture)
+    {
+      return;
+    }
+    texture.update ((sf::Uint8 const*)framebuffer.data ());
+    renderer.get_window ().draw (sprite);
+  }
+
+  /// <summary>
+  /// write the framebuffer to a binary PPM (alpha is dropped, it is always 255 over an opaque clear colour)
+  /// </summary>
+  bool write_ppm (std::string const& path) const
+  {
+    FILE* const file = std::fopen (path.c_str (), "wb");
+    if (!file)
+    {
+      return false;
+    }
+    std::fprintf (file, "P6\n%u %u\n255\n", SCREEN_WIDTH, SCREEN_HEIGHT);
+    std::vector <unsigned char> row (SCREEN_WIDTH * 3u);
+    for (unsigned y = 0u; y < SCREEN_HEIGHT; ++y)
+    {
+      for (unsigned x = 0u; x < SCREEN_WIDTH; ++x)
+      {
+        sf::Color const colour = framebuffer [y * SCREEN_WIDTH + x];
+        row [x * 3u] = colour.r;
+        row [x * 3u + 1u] = colour.g;
+        row [x * 3u + 2u] = colour.b;
+      }
+      std::fwrite (row.data (), 1u, row.size (), file);
+    }
+    return std::fclose (file) == 0;
+  }
+
+  /// <returns>SCREEN_WIDTH * SCREEN_HEIGHT pixels, row by row</returns>
+  sf::Color const* get_framebuffer () const
+  {
+    return framebuffer.data ();
+  }
+
+  sf::Color get_clear_colour () const
+  {
+    return clear_colour;
+  }
+
+  /// <returns>where the sprite draws the framebuffer, from texture pixels (column, row) to world positions</returns>
+  sf::Transform const& get_sprite_transform () const
+  {
+    return sprite.getTransform ();
+  }
+
+  void release ()
+  {
+    framebuffer.clear ();
+    splats.clear ();
+    bin_offsets.clear ();
+    tile_starts.clear ();
+  }
+
+private:
+  struct splat
+  {
+    unsigned pixel; // y * SCREEN_WIDTH + x
+    sf::Color colour;
+  };
+
+  /// <returns>true, if the vertex covers a pixel of the screen (false for NaN positions), with its index in pixel</returns>
+  static bool pixel_of (sf::Vertex const& vertex, unsigned& pixel)
+  {
+    if (!vertex_on_screen (vertex))
+    {
+      return false;
+    }
+    pixel = vertex_pixel (vertex);
+    return true;
+  }
+
+  /// <returns>the tile a pixel index (row * SCREEN_WIDTH + column, from the top left) is in</returns>
+  static unsigned tile_of (unsigned pixel)
+  {
+    return (pixel / SCREEN_WIDTH / TILE_SIZE) * TILES_X + (pixel % SCREEN_WIDTH) / TILE_SIZE;
+  }
+
+  unsigned num_threads = 1u;
+  sf::Color clear_colour;
+  std::vector <sf::Color> framebuffer;
+  std::vector <splat> splats;          // every tile's bin, one after the other
+  std::vector <unsigned> bin_offsets;  // per thread per tile, counts then where the thread's next splat in the tile goes
+  std::vector <unsigned> tile_starts;  // where each tile's bin starts in splats, & the end of the last
+  std::atomic <unsigned> next_tile = { 0u };
+
+  sf::Texture texture;
+  sf::Sprite sprite;
+  bool has_texture = false;
+};
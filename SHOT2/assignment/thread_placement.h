@@ -0,0 +1,357 @@
+// HOW IT WORKS:
+//
+// Where the worker threads run & which memory node their particles live on.
+//
+// cpu_topology lists the CPUs of each NUMA node (memory node) the process may run on:
+// on Linux from /sys/devices/system/node, on Windows from GetNumaNodeProcessorMaskEx, elsewhere everything is one node.
+//
+// thread_placement gives each worker thread a CPU, taking one CPU from each node in turn, so the threads are spread evenly
+// over the nodes (& their memory controllers) & fill the first CPUs of each node (usually the physical cores) first.
+// With SHOT2_AFFINITY (see config.h) the threads are pinned to it:
+//   core - each thread only runs on its own CPU
+//   node - each thread runs on any CPU of its CPU's node, so the OS can still balance threads within a node
+// and by default (none) the threads are left to float, as before.
+//
+// Memory is placed on a node by first touch: a page goes on the node of the CPU that first writes it, not the one that allocated it.
+// The particle system places every worker before any particle chunk is written, & a chunk is first written by the thread
+// that first takes it, which for a slice's own chunks is the slice's own thread (see particle_arena::take_chunk),
+// so each thread's particles go on its own node. It records the node each slice's thread is on,
+// so the update can count how much of each node's work was on another node's memory.
+
+
+
+#pragma once
+
+#include "magpie.h"
+
+#include <algorithm> // for std::sort, std::remove_if, std::find
+#include <cstdio>   // for std::fopen, std::snprintf
+#include <cstdlib>  // for std::strtoul
+#include <cstring>  // for std::strcmp
+#include <thread>
+#include <vector>
+
+#if defined (__linux__)
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#define PLACEMENT_LINUX 1
+#else
+#define PLACEMENT_LINUX 0
+#endif // __linux__
+
+#if defined (_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX // keep std::min & std::max usable
+#endif // NOMINMAX
+#include <windows.h>
+#define PLACEMENT_WINDOWS 1
+#else
+#define PLACEMENT_WINDOWS 0
+#endif // _WIN32
+
+
+/// <summary>
+/// how worker threads are pinned, see the top of this file
+/// </summary>
+enum class thread_affinity
+{
+  none,
+  core,
+  node,
+};
+
+static char const* thread_affinity_name (thread_affinity affinity)
+{
+  return affinity == thread_affinity::core ? "core" : affinity == thread_affinity::node ? "node" : "none";
+}
+
+/// <returns>the affinity named by text ("core", "node" or "none"), none for anything else</returns>
+static thread_affinity thread_affinity_from_name (char const* text)
+{
+  return std::strcmp (text, "core") == 0 ? thread_affinity::core : std::strcmp (text, "node") == 0 ? thread_affinity::node : thread_affinity::none;
+}
+
+/// <summary>
+/// the CPUs of each NUMA node, CPU numbers are the OS's (on Windows, processor group * 64 + number in the group)
+/// </summary>
+struct cpu_topology
+{
+  std::vector <std::vector <unsigned>> nodes; // CPUs of each node, nodes with no usable CPUs are left out
+
+  /// <summary>
+  /// find the nodes & the CPUs the process may use, one node with every hardware thread if that is not possible
+  /// </summary>
+  static cpu_topology detect ()
+  {
+    cpu_topology topology;
+
+#if PLACEMENT_LINUX
+    cpu_set_t allowed;
+    CPU_ZERO (&allowed);
+    bool const have_allowed = sched_getaffinity (0, sizeof (allowed), &allowed) == 0;
+
+    if (DIR* const directory = opendir ("/sys/devices/system/node"))
+    {
+      std::vector <unsigned> node_ids;
+      while (dirent const* const entry = readdir (directory))
+      {
+        char* end = nullptr;
+        if (std::strncmp (entry->d_name, "node", 4) == 0)
+        {
+          unsigned long const id = std::strtoul (entry->d_name + 4, &end, 10);
+          if (end != entry->d_name + 4 && *end == '\0')
+          {
+            node_ids.push_back ((unsigned)id);
+          }
+        }
+      }
+      closedir (directory);
+      std::sort (node_ids.begin (), node_ids.end ());
+
+      for (unsigned const id : node_ids)
+      {
+        char path [64];
+        std::snprintf (path, sizeof (path), "/sys/devices/system/node/node%u/cpulist", id);
+        std::vector <unsigned> cpus = read_cpu_list (path);
+        if (have_allowed)
+        {
+          cpus.erase (std::remove_if (cpus.begin (), cpus.end (), [&allowed] (unsigned cpu)
+          {
+            return cpu >= CPU_SETSIZE || !CPU_ISSET (cpu, &allowed);
+          }), cpus.end ());
+        }
+        if (!cpus.empty ())
+        {
+          topology.nodes.push_back (cpus);
+        }
+      }
+    }
+#elif PLACEMENT_WINDOWS
+    ULONG highest = 0u;
+    if (GetNumaHighestNodeNumber (&highest))
+    {
+      for (USHORT node = 0u; node <= highest; ++node)
+      {
+        GROUP_AFFINITY affinity = {};
+        if (!GetNumaNodeProcessorMaskEx (node, &affinity))
+        {
+          continue;
+        }
+        std::vector <unsigned> cpus;
+        for (unsigned bit = 0u; bit < 64u; ++bit)
+        {
+          if (affinity.Mask & ((KAFFINITY)1 << bit))
+          {
+            cpus.push_back (affinity.Group * 64u + bit);
+          }
+        }
+        if (!cpus.empty ())
+        {
+          topology.nodes.push_back (cpus);
+        }
+      }
+    }
+#endif // PLACEMENT_LINUX / PLACEMENT_WINDOWS
+
+    if (topology.nodes.empty ())
+    {
+      unsigned const count = std::thread::hardware_concurrency ();
+      topology.nodes.emplace_back ();
+      for (unsigned cpu = 0u; cpu < (count > 0u ? count : 1u); ++cpu)
+      {
+        topology.nodes.back ().push_back (cpu);
+      }
+    }
+    return topology;
+  }
+
+  unsigned get_num_nodes () const
+  {
+    return (unsigned)nodes.size ();
+  }
+
+  /// <returns>index (into nodes) of the node a CPU is in, 0 if it is not in any</returns>
+  unsigned node_of (unsigned cpu) const
+  {
+    for (unsigned node = 0u; node < (unsigned)nodes.size (); ++node)
+    {
+      if (std::find (nodes [node].begin (), nodes [node].end (), cpu) != nodes [node].end ())
+      {
+        return node;
+      }
+    }
+    return 0u;
+  }
+
+private:
+#if PLACEMENT_LINUX
+  /// <summary>
+  /// read a kernel CPU list, e.g. "0-3,8-11"
+  /// </summary>
+  static std::vector <unsigned> read_cpu_list (char const* path)
+  {
+    std::vector <unsigned> cpus;
+    FILE* const file = std::fopen (path, "r");
+    if (!file)
+    {
+      return cpus;
+    }
+
+    char text [1024] = {};
+    if (std::fgets (text, sizeof (text), file))
+    {
+      char* cursor = text;
+      while (*cursor >= '0' && *cursor <= '9')
+      {
+        unsigned const first = (unsigned)std::strtoul (cursor, &cursor, 10);
+        unsigned last = first;
+        if (*cursor == '-')
+        {
+          last = (unsigned)std::strtoul (cursor + 1, &cursor, 10);
+        }
+        for (unsigned cpu = first; cpu <= last; ++cpu)
+        {
+          cpus.push_back (cpu);
+        }
+        if (*cursor == ',')
+        {
+          ++cursor;
+        }
+      }
+    }
+    std::fclose (file);
+    return cpus;
+  }
+#endif // PLACEMENT_LINUX
+};
+
+/// <summary>
+/// a CPU & node for each worker thread, & pinning the calling thread to its one, see the top of this file
+/// </summary>
+class thread_placement
+{
+public:
+  /// <param name="num_threads">number of worker threads, including the main thread (index 0)</param>
+  void initialise (cpu_topology const& topology, thread_affinity affinity, unsigned num_threads)
+  {
+    this->topology = topology;
+    this->affinity = affinity;
+
+    // a CPU from each node in turn
+    std::vector <unsigned> order, order_nodes;
+    for (size_t k = 0u; order.size () < total_cpus (); ++k)
+    {
+      for (unsigned node = 0u; node < this->topology.get_num_nodes (); ++node)
+      {
+        if (k < this->topology.nodes [node].size ())
+        {
+          order.push_back (this->topology.nodes [node][k]);
+          order_nodes.push_back (node);
+        }
+      }
+    }
+
+    cpus.resize (num_threads);
+    thread_nodes.resize (num_threads);
+    for (unsigned i = 0u; i < num_threads; ++i)
+    {
+      cpus [i] = order [i % order.size ()];
+      thread_nodes [i] = order_nodes [i % order.size ()];
+    }
+  }
+
+  /// <summary>
+  /// pin the calling thread to thread_index's CPU or node, does nothing without an affinity
+  /// </summary>
+  /// <returns>false, if the thread could not be pinned</returns>
+  bool apply (unsigned thread_index) const
+  {
+    if (affinity == thread_affinity::none)
+    {
+      return true;
+    }
+
+    std::vector <unsigned> const single_cpu = { cpus [thread_index] };
+    std::vector <unsigned> const& allowed = affinity == thread_affinity::core ? single_cpu : topology.nodes [thread_nodes [thread_index]];
+
+#if PLACEMENT_LINUX
+    cpu_set_t set;
+    CPU_ZERO (&set);
+    for (unsigned const cpu : allowed)
+    {
+      CPU_SET (cpu, &set);
+    }
+    return pthread_setaffinity_np (pthread_self (), sizeof (set), &set) == 0;
+#elif PLACEMENT_WINDOWS
+    // a thread can only be pinned within one processor group, a node's CPUs are always in one group
+    GROUP_AFFINITY group = {};
+    group.Group = (WORD)(allowed.front () / 64u);
+    for (unsigned const cpu : allowed)
+    {
+      group.Mask |= (KAFFINITY)1 << (cpu % 64u);
+    }
+    return SetThreadGroupAffinity (GetCurrentThread (), &group, nullptr) != 0;
+#else
+    (void)allowed;
+    return false;
+#endif // PLACEMENT_LINUX / PLACEMENT_WINDOWS
+  }
+
+  /// <summary>
+  /// node the calling thread is running on now, thread_index's own node when pinned
+  /// </summary>
+  unsigned current_node (unsigned thread_index) const
+  {
+    if (affinity != thread_affinity::none || topology.get_num_nodes () == 1u)
+    {
+      return thread_nodes [thread_index];
+    }
+
+#if PLACEMENT_LINUX
+    int const cpu = sched_getcpu ();
+    return cpu >= 0 ? topology.node_of ((unsigned)cpu) : 0u;
+#elif PLACEMENT_WINDOWS
+    PROCESSOR_NUMBER processor = {};
+    GetCurrentProcessorNumberEx (&processor);
+    return topology.node_of (processor.Group * 64u + processor.Number);
+#else
+    return 0u;
+#endif // PLACEMENT_LINUX / PLACEMENT_WINDOWS
+  }
+
+  /// <returns>index (into the topology's nodes) of thread_index's node</returns>
+  unsigned get_node (unsigned thread_index) const
+  {
+    return thread_nodes [thread_index];
+  }
+
+  unsigned get_cpu (unsigned thread_index) const
+  {
+    return cpus [thread_index];
+  }
+
+  unsigned get_num_nodes () const
+  {
+    return topology.get_num_nodes ();
+  }
+
+  thread_affinity get_affinity () const
+  {
+    return affinity;
+  }
+
+private:
+  size_t total_cpus () const
+  {
+    size_t total = 0u;
+    for (std::vector <unsigned> const& node : topology.nodes)
+      total += node.size ();
+    return total;
+  }
+
+  cpu_topology topology;
+  thread_affinity affinity = thread_affinity::none;
+  std::vector <unsigned> cpus;         // each thread's CPU
+  std::vector <unsigned> thread_nodes; // each thread's node, index into topology.nodes
+};
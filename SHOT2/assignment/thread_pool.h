@@ -0,0 +1,222 @@
+// HOW IT WORKS:
+//
+// A fixed set of long lived worker threads, created once in initialise and joined in release.
+// run () hands every thread the same job along with its thread index, then waits for all of them to finish.
+// The calling thread takes index 0 itself, so a pool of N threads only owns N - 1 std::threads.
+// run () is dispatch () followed by wait (): dispatch starts the workers & returns straight away,
+// so the calling thread can do something else (e.g. draw the last frame) while they run,
+// and wait () runs index 0's share on the calling thread & waits for the workers, the one sync point.
+//
+// Idle workers spin briefly on an atomic generation counter before blocking on a condition variable,
+// so back to back frames wake them without a kernel call, while a paused game does not burn the CPU.
+
+
+
+#pragma once
+
+#include "profiler.h"
+
+#include "magpie.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+/// <summary>
+/// number of threads to use when none is requested
+/// </summary>
+/// <returns>std::thread::hardware_concurrency, or 1 if it is unknown</returns>
+static unsigned default_thread_count ()
+{
+  unsigned const count = std::thread::hardware_concurrency ();
+  return count > 0u ? count : 1u;
+}
+
+class thread_pool
+{
+public:
+  thread_pool () = default;
+  thread_pool (thread_pool const&) = delete;
+  thread_pool& operator= (thread_pool const&) = delete;
+  ~thread_pool ()
+  {
+    release ();
+  }
+
+  /// <summary>
+  /// start the worker threads
+  /// </summary>
+  /// <param name="num_threads">total number of threads, including the thread calling run</param>
+  bool initialise (unsigned num_threads)
+  {
+    MAGPIE_DASSERT_MSG (num_threads > 0u, "num_threads must be greater than 0");
+    MAGPIE_DASSERT (threads.empty ());
+
+    this->num_threads = num_threads;
+    quit = false;
+
+    unsigned const first_generation = generation.load (std::memory_order_relaxed);
+    threads.reserve (num_threads - 1u);
+    for (unsigned i = 1u; i < num_threads; ++i)
+    {
+      threads.emplace_back (&thread_pool::thread_main, this, i, first_generation);
+    }
+
+    return true;
+  }
+
+  /// <summary>
+  /// call job (thread_index) once on every thread & wait for them all to return
+  /// </summary>
+  /// <param name="job">callable taking the thread index, 0 <-> { size () - 1 }</param>
+  template <typename job_t>
+  void run (job_t& job)
+  {
+    dispatch (job);
+    wait ();
+  }
+
+  /// <summary>
+  /// start job (thread_index) on every worker thread & return without waiting, index 0 is run by wait
+  /// </summary>
+  /// <param name="job">callable taking the thread index, must stay alive until wait returns</param>
+  template <typename job_t>
+  void dispatch (job_t& job)
+  {
+    MAGPIE_DASSERT_MSG (!dispatched, "wait for the last job before dispatching another");
+
+    task = &job;
+    invoke = [] (void* task, unsigned thread_index) { (*(job_t*)task) (thread_index); };
+    remaining.store (num_threads - 1u, std::memory_order_relaxed);
+    dispatched = true;
+
+    // wake the workers
+    {
+      std::lock_guard <std::mutex> lock (mutex);
+      generation.fetch_add (1u, std::memory_order_release);
+    }
+    wake.notify_all ();
+  }
+
+  /// <summary>
+  /// run index 0's share of the dispatched job on this thread, then wait for every worker to finish it
+  /// </summary>
+  void wait ()
+  {
+    if (!dispatched)
+    {
+      return;
+    }
+    dispatched = false;
+
+    // take a share of the work on this thread too
+    invoke (task, 0u);
+
+    // wait for the workers
+    for (unsigned spin = 0u; remaining.load (std::memory_order_acquire) != 0u; ++spin)
+    {
+      if (spin < SPIN_COUNT)
+      {
+        std::this_thread::yield ();
+        continue;
+      }
+
+      std::unique_lock <std::mutex> lock (mutex);
+      done.wait (lock, [this] { return remaining.load (std::memory_order_acquire) == 0u; });
+    }
+  }
+
+  /// <summary>
+  /// stop & join the worker threads
+  /// </summary>
+  void release ()
+  {
+    wait (); // finish anything dispatched
+    if (threads.empty ())
+    {
+      return;
+    }
+
+    {
+      std::lock_guard <std::mutex> lock (mutex);
+      quit = true;
+      generation.fetch_add (1u, std::memory_order_release);
+    }
+    wake.notify_all ();
+
+    for (std::thread& thread : threads)
+    {
+      thread.join ();
+    }
+    threads.clear ();
+    num_threads = 1u;
+  }
+
+  /// <returns>true, between dispatch & wait</returns>
+  bool is_dispatched () const
+  {
+    return dispatched;
+  }
+
+  /// <returns>total number of threads, including the thread calling run</returns>
+  unsigned size () const
+  {
+    return num_threads;
+  }
+
+private:
+  void thread_main (unsigned thread_index, unsigned seen)
+  {
+    PROFILE_THREAD ("worker", thread_index);
+
+    for (;;)
+    {
+      // wait for the next job
+      unsigned current = generation.load (std::memory_order_acquire);
+      for (unsigned spin = 0u; current == seen && spin < SPIN_COUNT; ++spin)
+      {
+        std::this_thread::yield ();
+        current = generation.load (std::memory_order_acquire);
+      }
+      if (current == seen)
+      {
+        std::unique_lock <std::mutex> lock (mutex);
+        wake.wait (lock, [this, seen] { return generation.load (std::memory_order_acquire) != seen; });
+        current = generation.load (std::memory_order_acquire);
+      }
+      seen = current;
+
+      if (quit)
+      {
+        return;
+      }
+
+      invoke (task, thread_index);
+
+      // last one out wakes wait
+      if (remaining.fetch_sub (1u, std::memory_order_acq_rel) == 1u)
+      {
+        std::lock_guard <std::mutex> lock (mutex);
+        done.notify_one ();
+      }
+    }
+  }
+
+  static unsigned const SPIN_COUNT = 1024u;
+
+  std::vector <std::thread> threads;
+  unsigned num_threads = 1u;
+
+  std::mutex mutex;
+  std::condition_variable wake, done;
+  std::atomic <unsigned> generation = { 0u };
+  std::atomic <unsigned> remaining = { 0u };
+  bool quit = false;
+
+  void* task = nullptr;
+  void (*invoke) (void*, unsigned) = nullptr;
+  bool dispatched = false; // only touched by the calling thread
+};
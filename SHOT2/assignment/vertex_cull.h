@@ -0,0 +1,170 @@
+// HOW IT WORKS:
+//
+// An optional pass between the update & particle_renderer_2d::render that drops vertices which would not change the picture,
+// so fewer vertices are uploaded & drawn (SHOT2_CULL, see config.h):
+//   screen - drops vertices outside the screen (particles drifting off the sides, empty vertex slots)
+//   pixel  - also keeps only the last vertex drawn on each pixel, the one that would be on top
+//
+// Magpie's view puts the origin at the centre of the screen with +y up, so the screen is x from -SCREEN_WIDTH / 2 to SCREEN_WIDTH / 2
+// & y from -SCREEN_HEIGHT / 2 (bottom) to SCREEN_HEIGHT / 2 (top), see emitters.ini.
+// Each particle is a single pixel: a point at (x, y) covers column floor (x + SCREEN_WIDTH / 2) & row floor (SCREEN_HEIGHT / 2 - y),
+// counted from the top left, see vertex_screen_position.
+// The update writes every vertex into a scratch array, then the pass compacts the survivors into the renderer's vertex array
+// in their original order, split evenly between the worker threads:
+//   claim   - (pixel only) each vertex writes its index into its pixel's owner with an atomic max, so the last vertex wins
+//   count   - each thread counts its survivors, a vertex survives if it is on screen (& still owns its pixel)
+//   compact - each thread copies its survivors to its place, after the survivors of every thread before it
+// A pixel owner holds the frame number in its top 32 bits & the vertex index + 1 in the bottom 32,
+// so a later frame always beats an earlier one & the 1.5M owners (12 MB) never need clearing.
+//
+// With opaque colours (every built in type), keeping only the last vertex on a pixel draws exactly the same picture,
+// translucent particles would have blended with the ones underneath.
+
+
+
+#pragma once
+
+#include "constants.h"
+
+#include "magpie.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>  // for std::strcmp
+#include <memory>   // for std::unique_ptr
+
+
+/// <summary>
+/// which vertices are dropped before rendering, see the top of this file
+/// </summary>
+enum class vertex_cull_mode
+{
+  none,
+  screen,
+  pixel,
+};
+
+static char const* vertex_cull_mode_name (vertex_cull_mode mode)
+{
+  return mode == vertex_cull_mode::screen ? "screen" : mode == vertex_cull_mode::pixel ? "pixel" : "none";
+}
+
+/// <returns>the mode named by text ("screen", "pixel" or "none"), none for anything else</returns>
+static vertex_cull_mode vertex_cull_mode_from_name (char const* text)
+{
+  return std::strcmp (text, "screen") == 0 ? vertex_cull_mode::screen : std::strcmp (text, "pixel") == 0 ? vertex_cull_mode::pixel : vertex_cull_mode::none;
+}
+
+/// <returns>a vertex's position in pixels from the top left of the screen, x right & y down</returns>
+static sf::Vector2f vertex_screen_position (sf::Vertex const& vertex)
+{
+  return sf::Vector2f (vertex.position.x + (float)(SCREEN_WIDTH / 2u), (float)(SCREEN_HEIGHT / 2u) - vertex.position.y);
+}
+
+/// <returns>true, if the vertex covers a pixel of the screen, false for NaN positions</returns>
+static bool vertex_on_screen (sf::Vertex const& vertex)
+{
+  sf::Vector2f const screen = vertex_screen_position (vertex);
+  return screen.x >= 0.0f && screen.x < (float)SCREEN_WIDTH && screen.y >= 0.0f && screen.y < (float)SCREEN_HEIGHT;
+}
+
+/// <returns>index of the pixel an on screen vertex covers, row * SCREEN_WIDTH + column from the top left</returns>
+static unsigned vertex_pixel (sf::Vertex const& vertex)
+{
+  sf::Vector2f const screen = vertex_screen_position (vertex);
+  return (unsigned)screen.y * SCREEN_WIDTH + (unsigned)screen.x;
+}
+
+class vertex_culler
+{
+public:
+  void initialise (vertex_cull_mode mode)
+  {
+    this->mode = mode;
+    frame = 0u;
+    if (mode == vertex_cull_mode::pixel)
+    {
+      owners.reset (new std::atomic <std::uint64_t> [NUM_PIXELS]);
+      for (unsigned i = 0u; i < NUM_PIXELS; ++i)
+      {
+        owners [i].store (0u, std::memory_order_relaxed);
+      }
+    }
+  }
+
+  /// <summary>
+  /// start a new frame's pass, before any claim
+  /// </summary>
+  void next_frame ()
+  {
+    ++frame;
+  }
+
+  /// <summary>
+  /// make each on screen vertex in [first, end) the owner of its pixel, unless a later vertex already is, pixel mode only
+  /// </summary>
+  void claim (sf::Vertex const* vertices, unsigned first, unsigned end)
+  {
+    for (unsigned i = first; i < end; ++i)
+    {
+      if (!vertex_on_screen (vertices [i]))
+        continue;
+
+      std::atomic <std::uint64_t>& owner = owners [vertex_pixel (vertices [i])];
+      std::uint64_t const mine = stamp (i);
+      std::uint64_t current = owner.load (std::memory_order_relaxed);
+      while (current < mine && !owner.compare_exchange_weak (current, mine, std::memory_order_relaxed))
+      {
+      }
+    }
+  }
+
+  /// <returns>number of vertices in [first, end) that survive, after every claim has finished</returns>
+  unsigned count (sf::Vertex const* vertices, unsigned first, unsigned end) const
+  {
+    unsigned num_kept = 0u;
+    for (unsigned i = first; i < end; ++i)
+    {
+      num_kept += survives (vertices, i) ? 1u : 0u;
+    }
+    return num_kept;
+  }
+
+  /// <summary>
+  /// copy the vertices in [first, end) that survive to out, in order
+  /// </summary>
+  void compact (sf::Vertex const* vertices, unsigned first, unsigned end, sf::Vertex* out) const
+  {
+    for (unsigned i = first; i < end; ++i)
+    {
+      if (survives (vertices, i))
+      {
+        *out++ = vertices [i];
+      }
+    }
+  }
+
+  vertex_cull_mode get_mode () const
+  {
+    return mode;
+  }
+
+private:
+  static unsigned const NUM_PIXELS = SCREEN_WIDTH * SCREEN_HEIGHT;
+
+  std::uint64_t stamp (unsigned index) const
+  {
+    return ((std::uint64_t)frame << 32) | ((std::uint64_t)index + 1u);
+  }
+
+  bool survives (sf::Vertex const* vertices, unsigned i) const
+  {
+    if (!vertex_on_screen (vertices [i]))
+      return false;
+    return mode != vertex_cull_mode::pixel || owners [vertex_pixel (vertices [i])].load (std::memory_order_relaxed) == stamp (i);
+  }
+
+  vertex_cull_mode mode = vertex_cull_mode::none;
+  unsigned frame = 0u;
+  std::unique_ptr <std::atomic <std::uint64_t> []> owners; // pixel mode only, see the top of this file
+};
@@ -0,0 +1,186 @@
+// HOW IT WORKS:
+//
+// A large block of address space that is reserved once & backed by memory a piece at a time as it is used.
+// Nothing in the block ever moves, so pointers into it (e.g. particle_pool's arrays) stay valid however much is used,
+// and a capacity of 64M particles only costs memory for the particles actually spawned.
+//
+//   Linux   - mmap without reserving swap (MAP_NORESERVE), pages are given memory by the kernel when first written,
+//             so commit has nothing to do. With huge pages the block is 2MB aligned & marked with madvise (MADV_HUGEPAGE),
+//             so transparent huge pages back it where they can (if /sys/kernel/mm/transparent_hugepage allows it).
+//   Windows - VirtualAlloc MEM_RESERVE, then MEM_COMMIT for each piece as it is used. Large pages can only be committed
+//             all at once & need the 'Lock pages in memory' privilege, so with huge pages the whole block is committed
+//             with MEM_LARGE_PAGES up front, falling back to normal pages if that fails.
+//   other   - a single ordinary allocation, everything committed up front.
+//
+// Fewer, larger pages cut TLB misses when a frame streams through hundreds of MB of particles.
+
+
+
+#pragma once
+
+#include "magpie.h"
+
+#include <cstddef>  // for size_t
+#include <cstdint>  // for std::uintptr_t
+#include <new>      // for std::align_val_t
+
+#if defined (__linux__)
+#include <sys/mman.h>
+#define VIRTUAL_MEMORY_LINUX 1
+#else
+#define VIRTUAL_MEMORY_LINUX 0
+#endif // __linux__
+
+#if defined (_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX // keep std::min & std::max usable
+#endif // NOMINMAX
+#include <windows.h>
+#define VIRTUAL_MEMORY_WINDOWS 1
+#else
+#define VIRTUAL_MEMORY_WINDOWS 0
+#endif // _WIN32
+
+
+class virtual_memory
+{
+public:
+  static size_t const PAGE_SIZE = 4096u;
+  static size_t const HUGE_PAGE_SIZE = 2u * 1024u * 1024u;
+
+  virtual_memory () = default;
+  virtual_memory (virtual_memory const&) = delete;
+  virtual_memory& operator= (virtual_memory const&) = delete;
+  ~virtual_memory ()
+  {
+    release ();
+  }
+
+  /// <summary>
+  /// reserve address space for size bytes, page aligned, none of it is backed by memory until committed
+  /// </summary>
+  /// <param name="huge_pages">back the block with huge (2MB+) pages where possible, see get_huge_pages</param>
+  /// <returns>the start of the block, nullptr if it could not be reserved</returns>
+  void* reserve (size_t size, bool huge_pages)
+  {
+    MAGPIE_DASSERT (base == nullptr);
+
+    this->size = (size + PAGE_SIZE - 1u) & ~(PAGE_SIZE - 1u);
+    huge = false;
+    committed_up_front = false;
+
+#if VIRTUAL_MEMORY_LINUX
+    // over reserve by a huge page, so the block can start on a huge page boundary
+    size_t const padded = this->size + HUGE_PAGE_SIZE;
+    void* const mapping = mmap (nullptr, padded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (mapping == MAP_FAILED)
+    {
+      return nullptr;
+    }
+    std::uintptr_t const start = (std::uintptr_t)mapping;
+    std::uintptr_t const aligned = (start + HUGE_PAGE_SIZE - 1u) & ~(std::uintptr_t)(HUGE_PAGE_SIZE - 1u);
+    if (aligned > start)
+    {
+      munmap (mapping, aligned - start);
+    }
+    size_t const tail = (start + padded) - (aligned + this->size);
+    if (tail > 0u)
+    {
+      munmap ((void*)(aligned + this->size), tail);
+    }
+    base = (void*)aligned;
+#if defined (MADV_HUGEPAGE)
+    huge = huge_pages && madvise (base, this->size, MADV_HUGEPAGE) == 0;
+#endif // MADV_HUGEPAGE
+#elif VIRTUAL_MEMORY_WINDOWS
+    if (huge_pages)
+    {
+      size_t const large_page = GetLargePageMinimum ();
+      if (large_page > 0u)
+      {
+        size_t const large_size = (this->size + large_page - 1u) & ~(large_page - 1u);
+        base = VirtualAlloc (nullptr, large_size, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+        if (base != nullptr)
+        {
+          this->size = large_size;
+          huge = committed_up_front = true;
+        }
+      }
+    }
+    if (base == nullptr)
+    {
+      base = VirtualAlloc (nullptr, this->size, MEM_RESERVE, PAGE_NOACCESS);
+    }
+#else
+    base = ::operator new[] (this->size, std::align_val_t (PAGE_SIZE), std::nothrow);
+    committed_up_front = true;
+#endif // VIRTUAL_MEMORY_LINUX / VIRTUAL_MEMORY_WINDOWS
+
+    return base;
+  }
+
+  /// <summary>
+  /// back bytes [offset, offset + bytes) of the block with memory, rounded out to whole pages
+  /// safe from any thread, as long as no two threads commit the same pages at once
+  /// </summary>
+  /// <returns>false, if there was not enough memory</returns>
+  bool commit (size_t offset, size_t bytes)
+  {
+    MAGPIE_DASSERT (base != nullptr && offset + bytes <= size);
+
+    if (committed_up_front)
+    {
+      return true;
+    }
+
+#if VIRTUAL_MEMORY_WINDOWS
+    return VirtualAlloc ((char*)base + offset, bytes, MEM_COMMIT, PAGE_READWRITE) != nullptr;
+#else
+    // the kernel backs pages as they are first written
+    (void)offset;
+    (void)bytes;
+    return true;
+#endif // VIRTUAL_MEMORY_WINDOWS
+  }
+
+  void release ()
+  {
+    if (base == nullptr)
+    {
+      return;
+    }
+
+#if VIRTUAL_MEMORY_LINUX
+    munmap (base, size);
+#elif VIRTUAL_MEMORY_WINDOWS
+    VirtualFree (base, 0u, MEM_RELEASE);
+#else
+    ::operator delete[] (base, std::align_val_t (PAGE_SIZE));
+#endif // VIRTUAL_MEMORY_LINUX / VIRTUAL_MEMORY_WINDOWS
+    base = nullptr;
+    size = 0u;
+  }
+
+  void* get_base () const
+  {
+    return base;
+  }
+
+  /// <returns>size of the block in bytes</returns>
+  size_t get_size () const
+  {
+    return size;
+  }
+
+  /// <returns>true, if huge pages were asked for & the OS accepted them</returns>
+  bool get_huge_pages () const
+  {
+    return huge;
+  }
+
+private:
+  void* base = nullptr;
+  size_t size = 0u;
+  bool huge = false;
+  bool committed_up_front = false; // commit has nothing left to do
+};
@@ -0,0 +1,185 @@
+// HOW IT WORKS:
+//
+// Work stealing over a fixed list of tasks (indices 0 <-> { num_tasks - 1 }).
+// Before a frame's tasks are run, each thread is given a contiguous range of task indices, its own work.
+// A thread takes tasks from the front of its own range; once that is empty it steals from the back of the other threads' ranges,
+// so a thread that finishes early helps with the slowest thread's work rather than waiting for it.
+//
+// Each range is a single 64 bit atomic (front & back indices packed together) updated with compare-and-swap,
+// so the owner & thieves never take a lock and can never take the same task twice.
+//
+// The scheduler also times how long each thread spends running tasks, giving a per frame load imbalance:
+//   load imbalance = slowest thread's busy time / average thread busy time
+// 1.0 means perfectly even work, 2.0 means the slowest thread did twice the average, etc.
+
+
+
+#pragma once
+
+#include "magpie.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+
+/// <summary>
+/// a range of task indices [front, back) that can be popped from the front by its owner & stolen from the back by other threads
+/// </summary>
+struct alignas (64) task_range // own cache line, ranges are hammered by different threads
+{
+  void reset (unsigned front, unsigned back)
+  {
+    bounds.store (pack (front, back), std::memory_order_relaxed);
+  }
+
+  /// <summary>
+  /// owner takes the first task in the range
+  /// </summary>
+  bool pop_front (unsigned& task)
+  {
+    std::uint64_t current = bounds.load (std::memory_order_acquire);
+    for (;;)
+    {
+      unsigned const front = (unsigned)current, back = (unsigned)(current >> 32);
+      if (front >= back)
+        return false;
+      if (bounds.compare_exchange_weak (current, pack (front + 1u, back), std::memory_order_acq_rel))
+      {
+        task = front;
+        return true;
+      }
+    }
+  }
+
+  /// <summary>
+  /// another thread takes the last task in the range
+  /// </summary>
+  bool steal_back (unsigned& task)
+  {
+    std::uint64_t current = bounds.load (std::memory_order_acquire);
+    for (;;)
+    {
+      unsigned const front = (unsigned)current, back = (unsigned)(current >> 32);
+      if (front >= back)
+        return false;
+      if (bounds.compare_exchange_weak (current, pack (front, back - 1u), std::memory_order_acq_rel))
+      {
+        task = back - 1u;
+        return true;
+      }
+    }
+  }
+
+private:
+  static std::uint64_t pack (unsigned front, unsigned back)
+  {
+    return (std::uint64_t)front | ((std::uint64_t)back << 32);
+  }
+
+  std::atomic <std::uint64_t> bounds = { 0u };
+};
+
+class work_stealing_scheduler
+{
+public:
+  /// <summary>
+  /// per thread timings from the last execute
+  /// </summary>
+  struct alignas (64) thread_stats
+  {
+    float busy_ms = 0.0f;
+    unsigned tasks_run = 0u;
+    unsigned tasks_stolen = 0u;
+  };
+
+  /// <summary>
+  /// set the number of threads & whether idle threads may steal
+  /// </summary>
+  void initialise (unsigned num_threads, bool allow_stealing = true)
+  {
+    ranges = std::vector <task_range> (num_threads);
+    stats.assign (num_threads, thread_stats ());
+    this->allow_stealing = allow_stealing;
+  }
+
+  /// <summary>
+  /// give a thread its own range of tasks for the next execute, called before the threads are started
+  /// </summary>
+  void assign (unsigned thread_index, unsigned first_task, unsigned end_task)
+  {
+    ranges [thread_index].reset (first_task, end_task);
+  }
+
+  /// <summary>
+  /// run tasks on the calling thread until there are none left anywhere
+  /// </summary>
+  /// <param name="thread_index">index of the calling thread</param>
+  /// <param name="run_task">callable taking a task index</param>
+  template <typename run_task_t>
+  void execute (unsigned thread_index, run_task_t&& run_task)
+  {
+    auto const start = std::chrono::steady_clock::now ();
+    thread_stats& thread = stats [thread_index];
+    thread.tasks_run = thread.tasks_stolen = 0u;
+
+    // own work first
+    unsigned task = 0u;
+    while (ranges [thread_index].pop_front (task))
+    {
+      run_task (task);
+      thread.tasks_run++;
+    }
+
+    // then help everyone else, starting with the next thread along so thieves spread out
+    unsigned const num_threads = (unsigned)ranges.size ();
+    for (unsigned offset = 1u; allow_stealing && offset < num_threads; ++offset)
+    {
+      task_range& victim = ranges [(thread_index + offset) % num_threads];
+      while (victim.steal_back (task))
+      {
+        run_task (task);
+        thread.tasks_run++;
+        thread.tasks_stolen++;
+      }
+    }
+
+    thread.busy_ms = std::chrono::duration <float, std::milli> (std::chrono::steady_clock::now () - start).count ();
+  }
+
+  /// <summary>
+  /// slowest thread's busy time / average busy time, for the last execute
+  /// </summary>
+  float get_load_imbalance () const
+  {
+    float total = 0.0f, slowest = 0.0f;
+    for (thread_stats const& thread : stats)
+    {
+      total += thread.busy_ms;
+      slowest = thread.busy_ms > slowest ? thread.busy_ms : slowest;
+    }
+    return total > 0.0f ? slowest * (float)stats.size () / total : 1.0f;
+  }
+
+  /// <summary>
+  /// number of tasks run by a thread other than the one they were assigned to, for the last execute
+  /// </summary>
+  unsigned get_tasks_stolen () const
+  {
+    unsigned total = 0u;
+    for (thread_stats const& thread : stats)
+      total += thread.tasks_stolen;
+    return total;
+  }
+
+  std::vector <thread_stats> const& get_thread_stats () const
+  {
+    return stats;
+  }
+
+private:
+  std::vector <task_range> ranges;
+  std::vector <thread_stats> stats;
+  bool allow_stealing = true;
+};
@@ -0,0 +1,171 @@
+// APP NOTES:
+//
+// Headless variant of the assignment project, for benchmarking on machines without a display (build machines, CI runners).
+// No window or magpie::renderer is created, so timings are not tied to vsync or SFML presentation.
+// The particle system runs for SHOT2_FRAMES frames (default 600) at a fixed elapsed time (SHOT2_FIXED_DT, default 1/60s),
+// every frame's vertices are written into the particle renderer's vertex array by update & then thrown away instead of being drawn.
+//
+// At the end the time per particle is reported for each phase separately:
+//   emit         - planning how many particles each chunk spawns
+//   update       - the fused pass, integrating, killing & spawning particles and writing a vertex per particle
+//   cull         - with SHOT2_CULL, dropping the vertices that would not change the picture (see vertex_cull.h)
+//   rasterise    - with SHOT2_RENDERER=software, drawing the vertices into the framebuffer (see software_renderer.h)
+// along with the estimated memory traffic per particle, the bandwidth the update pass achieved
+// & how full the particle system was kept on average (see particle_budget.h), each memory node's share of that bandwidth
+// & how many chunks were updated from another node's memory (see thread_placement.h, SHOT2_AFFINITY pins the threads),
+// then the p50/p99/p99.9 of each phase's per frame time (see frame_stats.h, also written to SHOT2_STATS .csv & .json).
+// The data a window would hand the GPU each frame is shown for both renderers: the point list (20 bytes a vertex)
+// & the software renderer's framebuffer texture. With the software renderer the last frame is also drawn again
+// one point at a time, as SFML draws a point list, compared with the tiled framebuffer & written to SHOT2_FRAME_DUMP .ppm.
+// With SHOT2_ANALYTIC=1 the update evaluates each particle from its spawn state instead (see update_chunk_analytic).
+// SHOT2_PIPELINED is ignored, there is no drawing for the simulation to overlap with.
+// All other SHOT2_* environment variables work as normal, see 'config.h', e.g. SHOT2_TRACE records a Chrome trace of the run.
+
+
+
+#include "../assignment/constants.h"       // for PARTICLE_MAX
+#include "../assignment/particle_system.h" // for particle_system_t
+#include "../assignment/config.h"          // for config_from_environment
+#include "../assignment/frame_stats.h"     // for frame_stats
+
+#include "magpie.h"                        // for magpie::printf
+
+
+ENTRY_POINT
+{
+  // SETUP
+
+  particle_system_config config = config_from_environment ();
+  if (config.num_frames == 0u)
+  {
+    config.num_frames = 600u;
+  }
+  if (config.fixed_elapsed_seconds <= 0.0f)
+  {
+    config.fixed_elapsed_seconds = 1.0f / 60.0f;
+  }
+  config.pipelined = false;
+
+  particle_system_t particle_system;
+  if (!particle_system.initialise (config))
+  {
+    MAGPIE_DASSERT (false);
+  }
+
+
+  // FRAME LOOP
+
+  // phase times (ms) & particles processed, summed over every frame
+  double emit_ms = 0.0, update_ms = 0.0, cull_ms = 0.0, raster_ms = 0.0;
+  double particles_updated = 0.0, vertices_filled = 0.0, vertices_drawn = 0.0;
+  long long num_active_particles = 0;
+  unsigned heap_allocations = 0u;
+
+  frame_stats stats;
+  stats.initialise (config.stats_path, config.stats_window);
+  Timer frame_timer;
+
+  for (unsigned frame = 0u; frame < config.num_frames; ++frame)
+  {
+    PROFILE_FRAME ("headless");
+    frame_timer.start ();
+    long long const num_before = particle_system.get_num_particles ();
+    particle_system.update (config.fixed_elapsed_seconds, num_active_particles);
+    particle_system.discard_vertices ();
+
+    particle_system_t::phase_timings const& timings = particle_system.get_timings ();
+    emit_ms += timings.emit_ms;
+    update_ms += timings.update_ms;
+    cull_ms += timings.cull_ms;
+    raster_ms += timings.raster_ms;
+    particles_updated += num_before;
+    vertices_filled += particle_system.get_counts ().num_vertices;
+    vertices_drawn += particle_system.get_counts ().num_drawn;
+    heap_allocations += particle_system.get_heap_allocations ();
+
+    frame_timer.stop ();
+    stats.record (frame_phase_frame, frame_timer.get_elapsed_ms ());
+    stats.record (frame_phase_emit, timings.emit_ms);
+    stats.record (frame_phase_update, timings.update_ms);
+    stats.end_frame ();
+  }
+  stats.release ();
+
+
+  // REPORT
+
+  // per particle alive during the phase, so every phase is comparable with the total frame time
+  auto const ns_per = [] (double ms, double count)
+  {
+    return count > 0.0 ? ms * 1'000'000.0 / count : 0.0;
+  };
+
+  magpie::printf ("\nheadless: %u frames, dt = %.5fs, %u threads, %s renderer, %lld particles at the end\n",
+    config.num_frames, config.fixed_elapsed_seconds, particle_system.get_num_threads (),
+    particle_render_mode_name (particle_system.get_render_mode ()), particle_system.get_num_particles ());
+  magpie::printf ("  emit         %10.2f ms total  %8.3f ns/particle\n", emit_ms, ns_per (emit_ms, particles_updated));
+  magpie::printf ("  update       %10.2f ms total  %8.3f ns/particle (%.0f vertices)\n", update_ms, ns_per (update_ms, particles_updated), vertices_filled);
+  bool const software = particle_system.get_render_mode () == particle_render_mode::software;
+  if (software)
+  {
+    magpie::printf ("  rasterise    %10.2f ms total  %8.3f ns/particle (%.0f vertices on screen)\n",
+      raster_ms, ns_per (raster_ms, particles_updated), vertices_drawn);
+  }
+  else if (config.cull != vertex_cull_mode::none)
+  {
+    magpie::printf ("  cull %-7s %10.2f ms total  %8.3f ns/particle (%.0f vertices left, %.1f%%)\n", vertex_cull_mode_name (config.cull),
+      cull_ms, ns_per (cull_ms, particles_updated), vertices_drawn, vertices_filled > 0.0 ? 100.0 * vertices_drawn / vertices_filled : 0.0);
+  }
+  double const total_ms = emit_ms + update_ms + cull_ms + raster_ms;
+  magpie::printf ("  total        %10.2f ms total  %8.3f ns/particle\n", total_ms, ns_per (total_ms, particles_updated));
+
+  // what a window would upload each frame, the software renderer does not cull so its point list would be every vertex
+  double const point_list_mb = (software ? vertices_filled : vertices_drawn) * sizeof (sf::Vertex) / config.num_frames / (1024.0 * 1024.0);
+  double const framebuffer_mb = (double)SCREEN_WIDTH * SCREEN_HEIGHT * sizeof (sf::Color) / (1024.0 * 1024.0);
+  magpie::printf ("  upload       ~%.1f MB/frame as a point list, ~%.1f MB/frame as the software renderer's framebuffer\n",
+    point_list_mb, framebuffer_mb);
+
+  // bytes/ns == GB/s
+  double const update_ns = update_ms * 1'000'000.0;
+  unsigned const bytes_per_particle = config.analytic ? ANALYTIC_PASS_BYTES_PER_PARTICLE : FUSED_PASS_BYTES_PER_PARTICLE;
+  magpie::printf ("  memory traffic ~%u bytes/particle%s (~%u with separate process, expiry & render passes), ~%.2f GB/s\n",
+    bytes_per_particle, config.analytic ? " analytic" : "", SEPARATE_PASSES_BYTES_PER_PARTICLE,
+    update_ns > 0.0 ? (double)bytes_per_particle * particles_updated / update_ns : 0.0);
+  magpie::printf ("  occupancy    %10.1f%% of %u particles on average, %s budget\n",
+    100.0 * particles_updated / ((double)config.num_frames * particle_system.get_max_particles ()), particle_system.get_max_particles (),
+    particle_system.has_shared_budget () ? "shared" : "fixed per thread");
+  magpie::printf ("  heap allocations during update: %u (%u arena chunks in use, %.1f MB committed)\n",
+    heap_allocations, particle_system.get_chunks_in_use (), (double)particle_system.get_committed_bytes () / (1024.0 * 1024.0));
+  std::vector <particle_system_t::node_traffic> const nodes = particle_system.get_node_traffic ();
+  for (size_t i = 0u; i < nodes.size (); ++i)
+  {
+    unsigned long long const chunks = nodes [i].local_chunks + nodes [i].remote_chunks;
+    magpie::printf ("  node %-7u %2u threads  ~%6.2f GB/s  %5.1f%% of chunks on another node's memory\n", (unsigned)i,
+      nodes [i].num_threads, nodes [i].gigabytes_per_second, chunks > 0u ? 100.0 * (double)nodes [i].remote_chunks / (double)chunks : 0.0);
+  }
+  for (frame_phase const phase : { frame_phase_frame, frame_phase_emit, frame_phase_update })
+  {
+    latency_histogram const& histogram = stats.get_total (phase);
+    magpie::printf ("  %-6s ms/frame  p50 %8.3f  p99 %8.3f  p99.9 %8.3f  max %8.3f\n", FRAME_PHASE_NAMES [phase],
+      (double)histogram.percentile (0.5) / 1e6, (double)histogram.percentile (0.99) / 1e6,
+      (double)histogram.percentile (0.999) / 1e6, (double)histogram.get_max () / 1e6);
+  }
+
+
+  // the last frame, one point at a time as SFML would draw it, against the tiles
+  if (software)
+  {
+    unsigned const num_different = particle_system.check_software_frame ();
+    std::string const path = std::string (config.frame_dump_path) + ".ppm";
+    bool const written = particle_system.get_software_renderer ().write_ppm (path);
+    magpie::printf ("  last frame   %u pixels differ from the points drawn in order, %s '%s'\n",
+      num_different, written ? "written to" : "could not be written to", path.c_str ());
+  }
+
+
+  // RELEASE RESOURCES
+
+  particle_system.release ();
+
+  return 0;
+}
@@ -0,0 +1,10 @@
+// APP NOTES:
+//
+// SIMD variant of the assignment project.
+// The project name contains 'simd', so CMake defines MAGPIE_SIMD for it
+// and process picks the widest integration kernel the CPU supports at startup (see 'particle_simd.h').
+// Everything else is shared with the assignment project, so both can be built & timed side by side.
+
+
+
+#include "../assignment/main.cpp"